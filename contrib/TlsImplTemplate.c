@@ -38,6 +38,15 @@ TlsInitClient(int fd, const char *serverName)
     return NULL;
 }
 
+/*
+ * This is called for every connection a TLS listener accepts, and the
+ * HTTP server closes connections after every response, so clients
+ * reconnect often. Rather than setting up a new context each time,
+ * keep one per certificate and key for the whole process, with a
+ * bounded session cache and session tickets enabled, so that
+ * returning clients can skip the full handshake. If the TLS library
+ * supports it, rotate the ticket keys now and then.
+ */
 void *
 TlsInitServer(int fd, const char *crt, const char *key)
 {
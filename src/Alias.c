@@ -0,0 +1,481 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <Alias.h>
+#include <Trace.h>
+
+#include <Cytoplasm/Memory.h>
+#include <Cytoplasm/Array.h>
+#include <Cytoplasm/Str.h>
+#include <Cytoplasm/Log.h>
+#include <Cytoplasm/Sha.h>
+
+#include <pthread.h>
+
+typedef struct CachedAlias
+{
+    char *id;
+    JsonValue *servers;
+} CachedAlias;
+
+static pthread_rwlock_t cacheLock = PTHREAD_RWLOCK_INITIALIZER;
+static HashMap *cache = NULL;
+
+/* Bumped whenever an alias is deleted, so that a lookup that read the
+ * alias before it was deleted doesn't put it back in the cache. */
+static unsigned long generation = 0;
+
+static void
+CachedAliasFree(CachedAlias * cached)
+{
+    if (cached)
+    {
+        Free(cached->id);
+        JsonValueFree(cached->servers);
+        Free(cached);
+    }
+}
+
+static HashMap *
+ResolveResponse(char *id, JsonValue * servers)
+{
+    HashMap *response = HashMapCreate();
+
+    HashMapSet(response, "room_id", JsonValueString(id));
+    HashMapSet(response, "servers", servers ?
+               JsonValueDuplicate(servers) : JsonValueArray(ArrayCreate()));
+
+    return response;
+}
+
+static DbRef *
+RoomLock(Db * db, char *id)
+{
+    DbRef *ref = TraceDbLock(db, 3, "aliases", "room", id);
+
+    if (!ref)
+    {
+        ref = DbCreate(db, 3, "aliases", "room", id);
+    }
+    if (!ref)
+    {
+        /* Someone else may have created it in the meantime. */
+        ref = TraceDbLock(db, 3, "aliases", "room", id);
+    }
+
+    return ref;
+}
+
+/*
+ * Get the name of the object that stores the given alias. The
+ * database may not keep every character of an object name apart, so
+ * two different aliases could otherwise end up in the same object.
+ * Naming objects by a hash of the alias avoids that; the alias itself
+ * is stored in the object and checked whenever it is read.
+ */
+static char *
+AliasKey(char *alias)
+{
+    unsigned char *hash = Sha256(alias);
+    char *key;
+
+    if (!hash)
+    {
+        return NULL;
+    }
+
+    key = ShaToHex(hash, HASH_SHA256);
+    Free(hash);
+
+    return key;
+}
+
+/* Whether the given alias object really is for the given alias. */
+static int
+AliasMatches(DbRef * ref, char *alias)
+{
+    return StrEquals(JsonValueAsString(HashMapGet(DbJson(ref), "alias")), alias);
+}
+
+static int
+MigrateAlias(Db * db, char *alias, HashMap * json)
+{
+    char *key = AliasKey(alias);
+    DbRef *ref;
+
+    if (!key)
+    {
+        return 0;
+    }
+
+    ref = DbCreate(db, 3, "aliases", "alias", key);
+    if (!ref)
+    {
+        /* Left over from an earlier migration that didn't finish. */
+        ref = TraceDbLock(db, 3, "aliases", "alias", key);
+    }
+    Free(key);
+
+    if (!ref)
+    {
+        return 0;
+    }
+
+    DbJsonSet(ref, json);
+    JsonValueFree(HashMapSet(DbJson(ref), "alias", JsonValueString(alias)));
+
+    return DbUnlock(db, ref);
+}
+
+static void
+Migrate(Db * db)
+{
+    DbRef *ref = TraceDbLock(db, 1, "aliases");
+    HashMap *aliases;
+    HashMap *rooms;
+    char *key;
+    JsonValue *val;
+    size_t migrated = 0;
+    size_t failed = 0;
+
+    if (!ref)
+    {
+        return;
+    }
+
+    aliases = JsonValueAsObject(HashMapGet(DbJson(ref), "alias"));
+    rooms = JsonValueAsObject(HashMapGet(DbJson(ref), "id"));
+
+    while (HashMapIterate(aliases, &key, (void **) &val))
+    {
+        if (MigrateAlias(db, key, JsonValueAsObject(val)))
+        {
+            migrated++;
+        }
+        else
+        {
+            failed++;
+        }
+    }
+
+    while (HashMapIterate(rooms, &key, (void **) &val))
+    {
+        DbRef *roomRef = RoomLock(db, key);
+
+        if (!roomRef)
+        {
+            failed++;
+            continue;
+        }
+
+        DbJsonSet(roomRef, JsonValueAsObject(val));
+        if (!DbUnlock(db, roomRef))
+        {
+            failed++;
+        }
+    }
+
+    DbUnlock(db, ref);
+
+    /* Only drop the old object once everything in it has been
+     * written, so that the next startup can try again otherwise. */
+    if (failed)
+    {
+        Log(LOG_WARNING, "Unable to migrate %lu room alias entries; "
+            "keeping the old alias store to try again on the next start.",
+            failed);
+        return;
+    }
+
+    if (!DbDelete(db, 1, "aliases"))
+    {
+        Log(LOG_WARNING, "Unable to remove the old alias store.");
+    }
+
+    Log(LOG_NOTICE, "Migrated %lu room aliases to the new alias store.", migrated);
+}
+
+int
+AliasInit(Db * db)
+{
+    if (!db)
+    {
+        return 0;
+    }
+
+    if (DbExists(db, 1, "aliases"))
+    {
+        Migrate(db);
+    }
+
+    pthread_rwlock_wrlock(&cacheLock);
+    if (!cache)
+    {
+        cache = HashMapCreate();
+    }
+    pthread_rwlock_unlock(&cacheLock);
+
+    return 1;
+}
+
+void
+AliasFree(void)
+{
+    char *key;
+    CachedAlias *cached;
+
+    pthread_rwlock_wrlock(&cacheLock);
+    if (cache)
+    {
+        while (HashMapIterate(cache, &key, (void **) &cached))
+        {
+            CachedAliasFree(cached);
+        }
+        HashMapFree(cache);
+        cache = NULL;
+    }
+    pthread_rwlock_unlock(&cacheLock);
+}
+
+HashMap *
+AliasResolve(Db * db, char *alias)
+{
+    CachedAlias *cached;
+    HashMap *response = NULL;
+    unsigned long gen;
+    DbRef *ref;
+    char *key;
+
+    if (!db || !alias)
+    {
+        return NULL;
+    }
+
+    pthread_rwlock_rdlock(&cacheLock);
+    cached = cache ? HashMapGet(cache, alias) : NULL;
+    if (cached)
+    {
+        response = ResolveResponse(cached->id, cached->servers);
+    }
+    gen = generation;
+    pthread_rwlock_unlock(&cacheLock);
+
+    if (response)
+    {
+        return response;
+    }
+
+    key = AliasKey(alias);
+    ref = key ? TraceDbLock(db, 3, "aliases", "alias", key) : NULL;
+    Free(key);
+    if (!ref)
+    {
+        return NULL;
+    }
+    if (!AliasMatches(ref, alias))
+    {
+        DbUnlock(db, ref);
+        return NULL;
+    }
+
+    cached = Malloc(sizeof(CachedAlias));
+    cached->id = StrDuplicate(JsonValueAsString(HashMapGet(DbJson(ref), "id")));
+    cached->servers = JsonValueDuplicate(HashMapGet(DbJson(ref), "servers"));
+    DbUnlock(db, ref);
+
+    response = ResolveResponse(cached->id, cached->servers);
+
+    pthread_rwlock_wrlock(&cacheLock);
+    if (cache && gen == generation && !HashMapGet(cache, alias))
+    {
+        HashMapSet(cache, alias, cached);
+        cached = NULL;
+    }
+    pthread_rwlock_unlock(&cacheLock);
+
+    CachedAliasFree(cached);
+    return response;
+}
+
+AliasStatus
+AliasCreate(Db * db, char *alias, char *id, char *user)
+{
+    DbRef *ref;
+    DbRef *roomRef;
+    HashMap *json;
+    Array *list;
+    char *key;
+    AliasStatus status;
+
+    if (!db || !alias || !id || !user)
+    {
+        return ALIAS_ERROR;
+    }
+
+    key = AliasKey(alias);
+    if (!key)
+    {
+        return ALIAS_ERROR;
+    }
+
+    /* Creating the object is what claims the alias. */
+    ref = DbCreate(db, 3, "aliases", "alias", key);
+    if (!ref)
+    {
+        status = DbExists(db, 3, "aliases", "alias", key) ?
+            ALIAS_EXISTS : ALIAS_ERROR;
+        Free(key);
+        return status;
+    }
+
+    json = DbJson(ref);
+    HashMapSet(json, "alias", JsonValueString(alias));
+    HashMapSet(json, "createdBy", JsonValueString(user));
+    HashMapSet(json, "id", JsonValueString(id));
+    HashMapSet(json, "servers", JsonValueArray(ArrayCreate()));
+
+    roomRef = RoomLock(db, id);
+    if (!roomRef)
+    {
+        DbUnlock(db, ref);
+        DbDelete(db, 3, "aliases", "alias", key);
+        Free(key);
+        return ALIAS_ERROR;
+    }
+
+    list = JsonValueAsArray(HashMapGet(DbJson(roomRef), "aliases"));
+    if (!list)
+    {
+        list = ArrayCreate();
+        HashMapSet(DbJson(roomRef), "aliases", JsonValueArray(list));
+    }
+    ArrayAdd(list, JsonValueString(alias));
+
+    DbUnlock(db, roomRef);
+    DbUnlock(db, ref);
+    Free(key);
+
+    return ALIAS_OK;
+}
+
+AliasStatus
+AliasDelete(Db * db, char *alias, char *user, int privileged)
+{
+    DbRef *ref;
+    DbRef *roomRef;
+    char *id;
+    char *key;
+    CachedAlias *cached;
+    int deleted;
+
+    if (!db || !alias || !user)
+    {
+        return ALIAS_ERROR;
+    }
+
+    key = AliasKey(alias);
+    if (!key)
+    {
+        return ALIAS_ERROR;
+    }
+
+    ref = TraceDbLock(db, 3, "aliases", "alias", key);
+    if (!ref)
+    {
+        Free(key);
+        return ALIAS_NOT_FOUND;
+    }
+
+    if (!AliasMatches(ref, alias))
+    {
+        DbUnlock(db, ref);
+        Free(key);
+        return ALIAS_NOT_FOUND;
+    }
+
+    if (!privileged &&
+        !StrEquals(user, JsonValueAsString(HashMapGet(DbJson(ref), "createdBy"))))
+    {
+        DbUnlock(db, ref);
+        Free(key);
+        return ALIAS_FORBIDDEN;
+    }
+
+    id = JsonValueAsString(HashMapGet(DbJson(ref), "id"));
+    roomRef = id ? TraceDbLock(db, 3, "aliases", "room", id) : NULL;
+    if (roomRef)
+    {
+        Array *list = JsonValueAsArray(HashMapGet(DbJson(roomRef), "aliases"));
+        size_t i;
+
+        for (i = 0; i < ArraySize(list); i++)
+        {
+            if (StrEquals(JsonValueAsString(ArrayGet(list, i)), alias))
+            {
+                JsonValueFree(ArrayDelete(list, i));
+                break;
+            }
+        }
+        DbUnlock(db, roomRef);
+    }
+
+    DbUnlock(db, ref);
+    deleted = DbDelete(db, 3, "aliases", "alias", key);
+    Free(key);
+    if (!deleted)
+    {
+        return ALIAS_ERROR;
+    }
+
+    pthread_rwlock_wrlock(&cacheLock);
+    cached = cache ? HashMapDelete(cache, alias) : NULL;
+    generation++;
+    pthread_rwlock_unlock(&cacheLock);
+
+    CachedAliasFree(cached);
+    return ALIAS_OK;
+}
+
+JsonValue *
+AliasList(Db * db, char *id)
+{
+    DbRef *ref;
+    JsonValue *list;
+
+    if (!db || !id)
+    {
+        return NULL;
+    }
+
+    ref = TraceDbLock(db, 3, "aliases", "room", id);
+    if (!ref)
+    {
+        return NULL;
+    }
+
+    list = JsonValueDuplicate(HashMapGet(DbJson(ref), "aliases"));
+    DbUnlock(db, ref);
+
+    return list;
+}
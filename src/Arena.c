@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <Arena.h>
+
+#include <Cytoplasm/Memory.h>
+
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+
+/* Every allocation is aligned to the size of this, so that any type
+ * can be stored in it. */
+typedef union ArenaAlign
+{
+    long l;
+    double d;
+    void *p;
+    void (*f) (void);
+} ArenaAlign;
+
+#define ARENA_ALIGN(n) \
+    (((n) + sizeof(ArenaAlign) - 1) / sizeof(ArenaAlign) * sizeof(ArenaAlign))
+
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    ArenaAlign data[1];
+} ArenaBlock;
+
+#define ARENA_HEADER offsetof(ArenaBlock, data)
+
+struct Arena
+{
+    ArenaBlock *head;
+    ArenaBlock *first;
+    size_t blockSize;
+};
+
+static ArenaBlock *
+BlockCreate(size_t size)
+{
+    ArenaBlock *block = Malloc(ARENA_HEADER + size);
+
+    if (!block)
+    {
+        return NULL;
+    }
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+
+    return block;
+}
+
+Arena *
+ArenaCreate(size_t blockSize)
+{
+    Arena *arena = Malloc(sizeof(Arena));
+
+    if (!arena)
+    {
+        return NULL;
+    }
+
+    arena->blockSize = ARENA_ALIGN(blockSize ? blockSize : 1);
+    arena->head = NULL;
+    arena->first = NULL;
+
+#ifndef TELODENDRIA_DEBUG
+    arena->first = BlockCreate(arena->blockSize);
+    if (!arena->first)
+    {
+        Free(arena);
+        return NULL;
+    }
+    arena->head = arena->first;
+#endif
+
+    return arena;
+}
+
+void *
+ArenaAlloc(Arena * arena, size_t size)
+{
+    ArenaBlock *block;
+    void *ptr;
+
+    if (!arena)
+    {
+        return NULL;
+    }
+
+    size = ARENA_ALIGN(size ? size : 1);
+
+#ifdef TELODENDRIA_DEBUG
+    /* Each allocation gets its own block, so that the Memory API
+     * tracks it. */
+    block = BlockCreate(size);
+    if (!block)
+    {
+        return NULL;
+    }
+    block->next = arena->head;
+    arena->head = block;
+#else
+    block = arena->head;
+    if (block->size - block->used < size)
+    {
+        block = BlockCreate(size > arena->blockSize ? size : arena->blockSize);
+        if (!block)
+        {
+            return NULL;
+        }
+        block->next = arena->head;
+        arena->head = block;
+    }
+#endif
+
+    ptr = (char *) block->data + block->used;
+    block->used += size;
+
+    return ptr;
+}
+
+char *
+ArenaStrDuplicate(Arena * arena, const char *str)
+{
+    size_t len;
+    char *dup;
+
+    if (!str)
+    {
+        return NULL;
+    }
+
+    len = strlen(str);
+    dup = ArenaAlloc(arena, len + 1);
+    if (dup)
+    {
+        memcpy(dup, str, len + 1);
+    }
+
+    return dup;
+}
+
+char *
+ArenaStrConcat(Arena * arena, size_t nStr,...)
+{
+    va_list argp;
+    size_t len = 0;
+    size_t i;
+    char *str;
+    char *ptr;
+
+    va_start(argp, nStr);
+    for (i = 0; i < nStr; i++)
+    {
+        char *arg = va_arg(argp, char *);
+
+        if (arg)
+        {
+            len += strlen(arg);
+        }
+    }
+    va_end(argp);
+
+    str = ArenaAlloc(arena, len + 1);
+    if (!str)
+    {
+        return NULL;
+    }
+
+    ptr = str;
+    va_start(argp, nStr);
+    for (i = 0; i < nStr; i++)
+    {
+        char *arg = va_arg(argp, char *);
+
+        if (arg)
+        {
+            size_t argLen = strlen(arg);
+
+            memcpy(ptr, arg, argLen);
+            ptr += argLen;
+        }
+    }
+    va_end(argp);
+
+    *ptr = '\0';
+    return str;
+}
+
+char *
+ArenaStrLower(Arena * arena, const char *str)
+{
+    char *lower = ArenaStrDuplicate(arena, str);
+    char *ptr;
+
+    for (ptr = lower; ptr && *ptr; ptr++)
+    {
+        *ptr = tolower((unsigned char) *ptr);
+    }
+
+    return lower;
+}
+
+void
+ArenaReset(Arena * arena)
+{
+    ArenaBlock *block;
+
+    if (!arena)
+    {
+        return;
+    }
+
+    block = arena->head;
+    while (block != arena->first)
+    {
+        ArenaBlock *next = block->next;
+
+        Free(block);
+        block = next;
+    }
+
+    arena->head = arena->first;
+    if (arena->first)
+    {
+        arena->first->used = 0;
+    }
+}
+
+void
+ArenaFree(Arena * arena)
+{
+    if (!arena)
+    {
+        return;
+    }
+
+    ArenaReset(arena);
+    Free(arena->first);
+    Free(arena);
+}
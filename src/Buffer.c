@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <Buffer.h>
+
+#include <Cytoplasm/Memory.h>
+#include <Cytoplasm/Io.h>
+
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#define BUFFER_INITIAL_SIZE 4096
+
+struct Buffer
+{
+    char *data;
+    size_t len;
+    size_t size;
+
+    Stream *stream;
+};
+
+static ssize_t
+BufferRead(void *cookie, void *buf, size_t n)
+{
+    (void) cookie;
+    (void) buf;
+    (void) n;
+
+    errno = EBADF;
+    return -1;
+}
+
+static ssize_t
+BufferWrite(void *cookie, void *buf, size_t n)
+{
+    Buffer *buffer = cookie;
+
+    if (buffer->len + n > buffer->size)
+    {
+        size_t size = buffer->size ? buffer->size : BUFFER_INITIAL_SIZE;
+        char *data;
+
+        while (buffer->len + n > size)
+        {
+            size *= 2;
+        }
+
+        data = Realloc(buffer->data, size);
+        if (!data)
+        {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        buffer->data = data;
+        buffer->size = size;
+    }
+
+    memcpy(buffer->data + buffer->len, buf, n);
+    buffer->len += n;
+
+    return n;
+}
+
+static off_t
+BufferSeek(void *cookie, off_t * off, int whence)
+{
+    (void) cookie;
+    (void) off;
+    (void) whence;
+
+    errno = ESPIPE;
+    return -1;
+}
+
+static int
+BufferClose(void *cookie)
+{
+    /* The data belongs to the buffer, not the stream. */
+    (void) cookie;
+    return 0;
+}
+
+Buffer *
+BufferCreate(void)
+{
+    Buffer *buffer = Malloc(sizeof(Buffer));
+    IoFunctions funcs;
+    Io *io;
+
+    if (!buffer)
+    {
+        return NULL;
+    }
+
+    buffer->data = NULL;
+    buffer->len = 0;
+    buffer->size = 0;
+
+    funcs.read = BufferRead;
+    funcs.write = BufferWrite;
+    funcs.seek = BufferSeek;
+    funcs.close = BufferClose;
+
+    io = IoCreate(buffer, funcs);
+    if (!io)
+    {
+        Free(buffer);
+        return NULL;
+    }
+
+    buffer->stream = StreamIo(io);
+    if (!buffer->stream)
+    {
+        IoClose(io);
+        Free(buffer);
+        return NULL;
+    }
+
+    return buffer;
+}
+
+Stream *
+BufferStream(Buffer * buffer)
+{
+    return buffer ? buffer->stream : NULL;
+}
+
+char *
+BufferData(Buffer * buffer)
+{
+    if (!buffer)
+    {
+        return NULL;
+    }
+
+    /* Anything still sitting in the stream's own buffer has to be
+     * written out before the data is complete. */
+    StreamFlush(buffer->stream);
+    return buffer->data;
+}
+
+size_t
+BufferLength(Buffer * buffer)
+{
+    if (!buffer)
+    {
+        return 0;
+    }
+
+    StreamFlush(buffer->stream);
+    return buffer->len;
+}
+
+ssize_t
+BufferSend(Buffer * buffer, Stream * stream)
+{
+    if (!buffer || !stream)
+    {
+        return -1;
+    }
+
+    StreamFlush(buffer->stream);
+    return BufferWriteBlock(stream, buffer->data, buffer->len);
+}
+
+ssize_t
+BufferWriteBlock(Stream * stream, const char *data, size_t len)
+{
+    size_t off = 0;
+    int fd;
+
+    if (!stream || (!data && len))
+    {
+        return -1;
+    }
+
+    fd = StreamFileno(stream);
+    if (fd >= 0)
+    {
+        /* Whatever the stream is holding has to go out first. */
+        StreamFlush(stream);
+
+        while (off < len)
+        {
+            ssize_t written = write(fd, data + off, len - off);
+
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return -1;
+            }
+
+            off += written;
+        }
+
+        return len;
+    }
+
+    /*
+     * Streams without a descriptor, such as TLS connections, can only
+     * be written through the stream API. Everything up to the next NUL
+     * byte goes out in one call.
+     */
+    while (off < len)
+    {
+        const char *nul = memchr(data + off, '\0', len - off);
+        size_t run = (nul ? (size_t) (nul - data) : len) - off;
+
+        if (run > INT_MAX)
+        {
+            run = INT_MAX;
+        }
+
+        if (run && StreamPrintf(stream, "%.*s", (int) run, data + off) < 0)
+        {
+            return -1;
+        }
+        off += run;
+
+        if (off < len && !data[off])
+        {
+            if (StreamPutc(stream, '\0') == EOF)
+            {
+                return -1;
+            }
+            off++;
+        }
+    }
+
+    return len;
+}
+
+void
+BufferReset(Buffer * buffer)
+{
+    if (!buffer)
+    {
+        return;
+    }
+
+    StreamFlush(buffer->stream);
+    buffer->len = 0;
+}
+
+void
+BufferFree(Buffer * buffer)
+{
+    if (!buffer)
+    {
+        return;
+    }
+
+    StreamClose(buffer->stream);
+    Free(buffer->data);
+    Free(buffer);
+}
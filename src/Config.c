@@ -22,7 +22,9 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
-#include <Schema/Config.h>
+#include <Config.h>
+#include <Deflate.h>
+#include <Trace.h>
 #include <Cytoplasm/Memory.h>
 #include <Cytoplasm/Json.h>
 #include <Cytoplasm/HashMap.h>
@@ -33,6 +35,7 @@
 #include <Cytoplasm/Util.h>
 
 #include <sys/types.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
@@ -44,6 +47,77 @@
 #define HOST_NAME_MAX _POSIX_HOST_NAME_MAX
 #endif
 
+typedef struct ConfigSnapshot
+{
+    Config config;                 /* Must be first */
+    unsigned long refs;
+} ConfigSnapshot;
+
+struct ConfigStore
+{
+    pthread_mutex_t lock;
+    ConfigSnapshot *current;
+};
+
+/*
+ * Split the global thread count between the listeners that don't set
+ * their own, in proportion to their weights. Every listener gets at
+ * least one thread.
+ */
+static void
+ConfigShareThreads(Config *tConfig)
+{
+    int64_t total = tConfig->threads;
+    int64_t weights = 0;
+    int64_t seen = 0;
+    size_t i;
+
+    if (total <= 0)
+    {
+        return;
+    }
+
+    for (i = 0; i < ArraySize(tConfig->listen); i++)
+    {
+        ConfigListener *listener = ArrayGet(tConfig->listen, i);
+
+        if (listener->weight <= 0)
+        {
+            listener->weight = 1;
+        }
+        if (listener->threads)
+        {
+            total -= listener->threads;
+        }
+        else
+        {
+            weights += listener->weight;
+        }
+    }
+
+    for (i = 0; i < ArraySize(tConfig->listen); i++)
+    {
+        ConfigListener *listener = ArrayGet(tConfig->listen, i);
+        int64_t before;
+
+        if (listener->threads)
+        {
+            continue;
+        }
+
+        /* Give each listener the threads between its running share
+         * and the one before it, so that rounding never loses any. */
+        before = total > 0 ? total * seen / weights : 0;
+        seen += listener->weight;
+        listener->threads = (total > 0 ? total * seen / weights : 0) - before;
+
+        if (listener->threads < 1)
+        {
+            listener->threads = 1;
+        }
+    }
+}
+
 void
 ConfigParse(HashMap * config, Config *tConfig)
 {
@@ -77,10 +151,44 @@ ConfigParse(HashMap * config, Config *tConfig)
         }
         snprintf(tConfig->baseUrl, len, "https://%s/", tConfig->serverName);
     }
+    if (!tConfig->slowRequestThreshold)
+    {
+        tConfig->slowRequestThreshold = 1000;
+    }
+    if (tConfig->rateLimit.enabled)
+    {
+        ConfigRateLimitBudget *login = &tConfig->rateLimit.login;
+        ConfigRateLimitBudget *general = &tConfig->rateLimit.general;
+
+        if (login->perMinute <= 0)
+        {
+            login->perMinute = 10;
+        }
+        if (login->burst <= 0)
+        {
+            login->burst = 5;
+        }
+        if (general->perMinute <= 0)
+        {
+            general->perMinute = 600;
+        }
+        if (general->burst <= 0)
+        {
+            general->burst = 100;
+        }
+    }
     if (!tConfig->log.timestampFormat)
     {
         tConfig->log.timestampFormat = StrDuplicate("default");
     }
+    if (tConfig->log.bufferSize < 0 || tConfig->log.rotate.size < 0 ||
+        tConfig->log.rotate.interval < 0)
+    {
+        tConfig->err = "Log buffer and rotation sizes must not be negative.";
+        ConfigFree(tConfig);
+        goto error;
+    }
+    ConfigShareThreads(tConfig);
     for (i = 0; i < ArraySize(tConfig->listen); i++)
     {
         ConfigListener *listener = ArrayGet(tConfig->listen, i);
@@ -96,6 +204,46 @@ ConfigParse(HashMap * config, Config *tConfig)
         {
             listener->port = 8008;
         }
+        if (listener->admission.maxQueueDelay < 0)
+        {
+            listener->admission.maxQueueDelay = 0;
+        }
+        if (listener->admission.maxInFlight < 0)
+        {
+            listener->admission.maxInFlight = 0;
+        }
+        if (listener->admission.maxInFlight &&
+            listener->admission.maxInFlight >= listener->threads)
+        {
+            /*
+             * Requests are only counted once a thread has picked them
+             * up, so there can never be more in flight than there are
+             * threads, and such a limit would never be reached.
+             */
+            tConfig->err = "A listener's admission.maxInFlight must be less than its threads.";
+            ConfigFree(tConfig);
+            goto error;
+        }
+        /* Negative timeouts disable them; 0 means the default. */
+        if (!listener->timeouts.body)
+        {
+            listener->timeouts.body = 30000;
+        }
+        if (!listener->timeouts.send)
+        {
+            listener->timeouts.send = 30000;
+        }
+        if (listener->compression.enabled)
+        {
+            if (listener->compression.threshold <= 0)
+            {
+                listener->compression.threshold = 1024;
+            }
+            if (listener->compression.level < 1 || listener->compression.level > 9)
+            {
+                listener->compression.level = DEFLATE_DEFAULT_LEVEL;
+            }
+        }
     }
     tConfig->ok = 1;
     tConfig->err = NULL;
@@ -136,6 +284,12 @@ ConfigCreateDefault(Db * db)
     config.registration = 0;
     config.federation = 1;
 
+    config.rateLimit.enabled = 1;
+    config.rateLimit.login.perMinute = 10;
+    config.rateLimit.login.burst = 5;
+    config.rateLimit.general.perMinute = 600;
+    config.rateLimit.general.burst = 100;
+
     /* Create serverName and baseUrl. */
     config.serverName = Malloc(HOST_NAME_MAX + 1);
     memset(config.serverName, 0, HOST_NAME_MAX + 1);
@@ -177,7 +331,7 @@ ConfigCreateDefault(Db * db)
 void
 ConfigLock(Db * db, Config *config)
 {
-    DbRef *ref = DbLock(db, 1, "config");
+    DbRef *ref = TraceDbLock(db, 1, "config");
 
     if (!ref)
     {
@@ -230,3 +384,146 @@ ConfigLogLevelToSyslog(ConfigLogLevel level)
     }
     return LOG_INFO;
 }
+
+static ConfigSnapshot *
+SnapshotCreate(HashMap * json)
+{
+    ConfigSnapshot *snapshot = Malloc(sizeof(ConfigSnapshot));
+
+    if (!snapshot)
+    {
+        return NULL;
+    }
+
+    ConfigParse(json, &snapshot->config);
+    if (!snapshot->config.ok)
+    {
+        Log(LOG_ERR, "%s", snapshot->config.err);
+        Free(snapshot);
+        return NULL;
+    }
+
+    /* The store holds one reference. */
+    snapshot->refs = 1;
+    return snapshot;
+}
+
+static void
+SnapshotFree(ConfigSnapshot * snapshot)
+{
+    ConfigFree(&snapshot->config);
+    Free(snapshot);
+}
+
+ConfigStore *
+ConfigStoreCreate(HashMap * json)
+{
+    ConfigStore *store;
+    ConfigSnapshot *snapshot = SnapshotCreate(json);
+
+    if (!snapshot)
+    {
+        return NULL;
+    }
+
+    store = Malloc(sizeof(ConfigStore));
+    if (!store)
+    {
+        SnapshotFree(snapshot);
+        return NULL;
+    }
+
+    pthread_mutex_init(&store->lock, NULL);
+    store->current = snapshot;
+
+    return store;
+}
+
+int
+ConfigStoreUpdate(ConfigStore * store, HashMap * json)
+{
+    ConfigSnapshot *snapshot;
+    ConfigSnapshot *old;
+
+    if (!store)
+    {
+        return 0;
+    }
+
+    snapshot = SnapshotCreate(json);
+    if (!snapshot)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    old = store->current;
+    store->current = snapshot;
+
+    /* Readers still holding the old snapshot keep it alive; the last
+     * one to release it frees it. */
+    if (--old->refs)
+    {
+        old = NULL;
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    if (old)
+    {
+        SnapshotFree(old);
+    }
+
+    return 1;
+}
+
+void
+ConfigStoreFree(ConfigStore * store)
+{
+    if (!store)
+    {
+        return;
+    }
+
+    SnapshotFree(store->current);
+    pthread_mutex_destroy(&store->lock);
+    Free(store);
+}
+
+Config *
+ConfigAcquire(ConfigStore * store)
+{
+    ConfigSnapshot *snapshot;
+
+    if (!store)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    snapshot = store->current;
+    snapshot->refs++;
+    pthread_mutex_unlock(&store->lock);
+
+    return &snapshot->config;
+}
+
+void
+ConfigRelease(ConfigStore * store, Config * config)
+{
+    ConfigSnapshot *snapshot = (ConfigSnapshot *) config;
+    unsigned long refs;
+
+    if (!store || !config)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    refs = --snapshot->refs;
+    pthread_mutex_unlock(&store->lock);
+
+    if (!refs)
+    {
+        SnapshotFree(snapshot);
+    }
+}
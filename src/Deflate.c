@@ -0,0 +1,939 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <Deflate.h>
+
+#include <Cytoplasm/Memory.h>
+
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define WINDOW_SIZE 32768
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+
+#define BLOCK_TOKENS 16384
+#define OUT_SIZE 16384
+#define STORED_MAX 65535
+
+#define LITLEN_CODES 286
+#define FIXED_LITLEN_CODES 288
+#define DIST_CODES 30
+#define CLEN_CODES 19
+
+typedef struct BitWriter
+{
+    unsigned char out[OUT_SIZE];
+    size_t pos;
+
+    uint32_t bits;
+    int count;
+
+    IoWriteFunc *write;
+    void *cookie;
+    int error;
+} BitWriter;
+
+typedef struct Deflater
+{
+    BitWriter w;
+
+    int32_t head[HASH_SIZE];
+    int32_t prev[WINDOW_SIZE];
+
+    /* A token is a literal byte if its distance is 0, and a match of
+     * the given length and distance otherwise. */
+    uint16_t lit[BLOCK_TOKENS];
+    uint16_t dist[BLOCK_TOKENS];
+    size_t tokens;
+
+    int maxChain;
+    int niceLength;
+    int lazy;
+} Deflater;
+
+static const unsigned short lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const unsigned char lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const unsigned short distBase[DIST_CODES] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+
+static const unsigned char distExtra[DIST_CODES] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const unsigned char clenOrder[CLEN_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* Search effort for each compression level, from 1 to 9. */
+static const int levelChain[9] = { 4, 8, 16, 32, 64, 128, 256, 1024, 4096 };
+static const int levelNice[9] = { 8, 16, 32, 32, 64, 128, 128, 258, 258 };
+
+static uint32_t crcTable[256];
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+static void
+CrcTableBuild(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        int k;
+
+        for (k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+        }
+        crcTable[i] = c;
+    }
+}
+
+static uint32_t
+Crc32(unsigned char *data, size_t len)
+{
+    uint32_t c = 0xFFFFFFFFU;
+    size_t i;
+
+    pthread_once(&crcOnce, CrcTableBuild);
+
+    for (i = 0; i < len; i++)
+    {
+        c = crcTable[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    }
+
+    return c ^ 0xFFFFFFFFU;
+}
+
+static uint32_t
+Adler32(unsigned char *data, size_t len)
+{
+    uint32_t a = 1;
+    uint32_t b = 0;
+
+    while (len)
+    {
+        /* 5552 is the most bytes that can be summed before b could
+         * overflow. */
+        size_t n = len < 5552 ? len : 5552;
+
+        len -= n;
+        while (n--)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+static void
+WriterFlush(BitWriter * w)
+{
+    size_t done = 0;
+
+    while (!w->error && done < w->pos)
+    {
+        ssize_t n = w->write(w->cookie, w->out + done, w->pos - done);
+
+        if (n <= 0)
+        {
+            w->error = 1;
+            break;
+        }
+        done += n;
+    }
+
+    w->pos = 0;
+}
+
+static void
+PutByte(BitWriter * w, unsigned char byte)
+{
+    w->out[w->pos++] = byte;
+    if (w->pos == OUT_SIZE)
+    {
+        WriterFlush(w);
+    }
+}
+
+/* Write the low bits of a value, least significant bit first. */
+static void
+PutBits(BitWriter * w, uint32_t value, int n)
+{
+    w->bits |= value << w->count;
+    w->count += n;
+
+    while (w->count >= 8)
+    {
+        PutByte(w, w->bits & 0xFF);
+        w->bits >>= 8;
+        w->count -= 8;
+    }
+}
+
+static void
+PutAlign(BitWriter * w)
+{
+    if (w->count)
+    {
+        PutByte(w, w->bits & 0xFF);
+    }
+    w->bits = 0;
+    w->count = 0;
+}
+
+static int
+LengthCode(int len)
+{
+    int i = 28;
+
+    while (len < lengthBase[i])
+    {
+        i--;
+    }
+    return i;
+}
+
+static int
+DistCode(int dist)
+{
+    int i = DIST_CODES - 1;
+
+    while (dist < distBase[i])
+    {
+        i--;
+    }
+    return i;
+}
+
+/*
+ * Compute Huffman code lengths for the given symbol frequencies, no
+ * longer than the given limit. If the optimal code is too long, the
+ * frequencies are flattened and the code is built again; this is not
+ * quite optimal, but it is simple, and it rarely happens.
+ */
+static void
+BuildLengths(unsigned int *freq, int n, int limit, unsigned char *lens)
+{
+    unsigned int f[FIXED_LITLEN_CODES];
+    unsigned long weight[2 * FIXED_LITLEN_CODES];
+    int parent[2 * FIXED_LITLEN_CODES];
+    int alive[2 * FIXED_LITLEN_CODES];
+    int i;
+
+    memcpy(f, freq, sizeof(unsigned int) * n);
+
+    for (;;)
+    {
+        int nodes = n;
+        int used = 0;
+        int last = 0;
+        int max = 0;
+
+        for (i = 0; i < n; i++)
+        {
+            lens[i] = 0;
+            weight[i] = f[i];
+            alive[i] = f[i] > 0;
+            parent[i] = -1;
+            if (f[i])
+            {
+                used++;
+                last = i;
+            }
+        }
+
+        if (used == 0)
+        {
+            return;
+        }
+        if (used == 1)
+        {
+            lens[last] = 1;
+            return;
+        }
+
+        while (used > 1)
+        {
+            int a = -1;
+            int b = -1;
+
+            for (i = 0; i < nodes; i++)
+            {
+                if (!alive[i])
+                {
+                    continue;
+                }
+                if (a < 0 || weight[i] < weight[a])
+                {
+                    b = a;
+                    a = i;
+                }
+                else if (b < 0 || weight[i] < weight[b])
+                {
+                    b = i;
+                }
+            }
+
+            weight[nodes] = weight[a] + weight[b];
+            alive[nodes] = 1;
+            parent[nodes] = -1;
+            alive[a] = 0;
+            alive[b] = 0;
+            parent[a] = nodes;
+            parent[b] = nodes;
+            nodes++;
+            used--;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            int depth = 0;
+            int j = i;
+
+            if (!f[i])
+            {
+                continue;
+            }
+
+            while (parent[j] >= 0)
+            {
+                depth++;
+                j = parent[j];
+            }
+
+            lens[i] = depth;
+            if (depth > max)
+            {
+                max = depth;
+            }
+        }
+
+        if (max <= limit)
+        {
+            return;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            if (f[i])
+            {
+                f[i] = (f[i] >> 1) | 1;
+            }
+        }
+    }
+}
+
+/* Assign canonical codes to the given lengths. The codes are stored
+ * bit-reversed, because Huffman codes are written most significant
+ * bit first. */
+static void
+BuildCodes(unsigned char *lens, int n, unsigned short *codes)
+{
+    int count[16];
+    int next[16];
+    int code = 0;
+    int i;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++)
+    {
+        count[lens[i]]++;
+    }
+    count[0] = 0;
+
+    for (i = 1; i < 16; i++)
+    {
+        code = (code + count[i - 1]) << 1;
+        next[i] = code;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        int c;
+        int r = 0;
+        int k;
+
+        codes[i] = 0;
+        if (!lens[i])
+        {
+            continue;
+        }
+
+        c = next[lens[i]]++;
+        for (k = 0; k < lens[i]; k++)
+        {
+            r = (r << 1) | (c & 1);
+            c >>= 1;
+        }
+        codes[i] = r;
+    }
+}
+
+static void
+PutTokens(Deflater * d, unsigned char *litLens, unsigned short *litCodes,
+          unsigned char *distLens, unsigned short *distCodes)
+{
+    BitWriter *w = &d->w;
+    size_t i;
+
+    for (i = 0; i < d->tokens; i++)
+    {
+        int lit = d->lit[i];
+        int dist = d->dist[i];
+        int lc;
+        int dc;
+
+        if (!dist)
+        {
+            PutBits(w, litCodes[lit], litLens[lit]);
+            continue;
+        }
+
+        lc = LengthCode(lit);
+        PutBits(w, litCodes[257 + lc], litLens[257 + lc]);
+        PutBits(w, lit - lengthBase[lc], lengthExtra[lc]);
+
+        dc = DistCode(dist);
+        PutBits(w, distCodes[dc], distLens[dc]);
+        PutBits(w, dist - distBase[dc], distExtra[dc]);
+    }
+
+    PutBits(w, litCodes[256], litLens[256]);
+}
+
+static void
+PutStored(Deflater * d, unsigned char *data, size_t len, int last)
+{
+    BitWriter *w = &d->w;
+
+    do
+    {
+        size_t n = len < STORED_MAX ? len : STORED_MAX;
+        size_t i;
+
+        PutBits(w, last && n == len, 1);
+        PutBits(w, 0, 2);
+        PutAlign(w);
+
+        PutByte(w, n & 0xFF);
+        PutByte(w, (n >> 8) & 0xFF);
+        PutByte(w, ~n & 0xFF);
+        PutByte(w, (~n >> 8) & 0xFF);
+
+        for (i = 0; i < n; i++)
+        {
+            PutByte(w, data[i]);
+        }
+
+        data += n;
+        len -= n;
+    } while (len);
+}
+
+/*
+ * Write out the tokens collected so far, which encode the given input,
+ * as a single block of whichever type comes out smallest.
+ */
+static void
+PutBlock(Deflater * d, unsigned char *data, size_t len, int last)
+{
+    BitWriter *w = &d->w;
+
+    unsigned int litFreq[LITLEN_CODES];
+    unsigned int distFreq[DIST_CODES];
+    unsigned char litLens[FIXED_LITLEN_CODES];
+    unsigned char distLens[DIST_CODES];
+    unsigned short litCodes[FIXED_LITLEN_CODES];
+    unsigned short distCodes[DIST_CODES];
+
+    unsigned char fixedLitLens[FIXED_LITLEN_CODES];
+    unsigned char fixedDistLens[DIST_CODES];
+
+    unsigned char all[LITLEN_CODES + DIST_CODES];
+    unsigned char rle[LITLEN_CODES + DIST_CODES];
+    unsigned char rleExtra[LITLEN_CODES + DIST_CODES];
+    size_t rleCount = 0;
+
+    unsigned int clenFreq[CLEN_CODES];
+    unsigned char clenLens[CLEN_CODES];
+    unsigned short clenCodes[CLEN_CODES];
+
+    int hlit;
+    int hdist;
+    int hclen;
+
+    unsigned long extraBits = 0;
+    unsigned long dynamicBits;
+    unsigned long fixedBits;
+    unsigned long storedBits;
+
+    size_t i;
+
+    memset(litFreq, 0, sizeof(litFreq));
+    memset(distFreq, 0, sizeof(distFreq));
+    memset(clenFreq, 0, sizeof(clenFreq));
+
+    for (i = 0; i < d->tokens; i++)
+    {
+        if (!d->dist[i])
+        {
+            litFreq[d->lit[i]]++;
+        }
+        else
+        {
+            int lc = LengthCode(d->lit[i]);
+            int dc = DistCode(d->dist[i]);
+
+            litFreq[257 + lc]++;
+            distFreq[dc]++;
+            extraBits += lengthExtra[lc] + distExtra[dc];
+        }
+    }
+    litFreq[256]++;
+
+    /* Dynamic Huffman codes. */
+    BuildLengths(litFreq, LITLEN_CODES, 15, litLens);
+    BuildLengths(distFreq, DIST_CODES, 15, distLens);
+    litLens[286] = 0;
+    litLens[287] = 0;
+
+    /* A block with no matches still has to describe one distance
+     * code. */
+    for (i = 0; i < DIST_CODES && !distLens[i]; i++);
+    if (i == DIST_CODES)
+    {
+        distLens[0] = 1;
+    }
+
+    for (hlit = LITLEN_CODES; hlit > 257 && !litLens[hlit - 1]; hlit--);
+    for (hdist = DIST_CODES; hdist > 1 && !distLens[hdist - 1]; hdist--);
+
+    memcpy(all, litLens, hlit);
+    memcpy(all + hlit, distLens, hdist);
+
+    /* Run-length encode the code lengths. */
+    i = 0;
+    while (i < (size_t) (hlit + hdist))
+    {
+        unsigned char l = all[i];
+        size_t run = 1;
+
+        while (i + run < (size_t) (hlit + hdist) && all[i + run] == l)
+        {
+            run++;
+        }
+        i += run;
+
+        if (!l)
+        {
+            while (run >= 11)
+            {
+                size_t r = run < 138 ? run : 138;
+
+                rle[rleCount] = 18;
+                rleExtra[rleCount++] = r - 11;
+                run -= r;
+            }
+            if (run >= 3)
+            {
+                rle[rleCount] = 17;
+                rleExtra[rleCount++] = run - 3;
+                run = 0;
+            }
+        }
+        else
+        {
+            rle[rleCount] = l;
+            rleExtra[rleCount++] = 0;
+            run--;
+
+            while (run >= 3)
+            {
+                size_t r = run < 6 ? run : 6;
+
+                rle[rleCount] = 16;
+                rleExtra[rleCount++] = r - 3;
+                run -= r;
+            }
+        }
+
+        while (run--)
+        {
+            rle[rleCount] = l;
+            rleExtra[rleCount++] = 0;
+        }
+    }
+
+    for (i = 0; i < rleCount; i++)
+    {
+        clenFreq[rle[i]]++;
+    }
+    BuildLengths(clenFreq, CLEN_CODES, 7, clenLens);
+
+    for (hclen = CLEN_CODES; hclen > 4 && !clenLens[clenOrder[hclen - 1]]; hclen--);
+
+    dynamicBits = 3 + 5 + 5 + 4 + 3 * hclen + extraBits;
+    for (i = 0; i < rleCount; i++)
+    {
+        dynamicBits += clenLens[rle[i]];
+        dynamicBits += rle[i] == 16 ? 2 : rle[i] == 17 ? 3 : rle[i] == 18 ? 7 : 0;
+    }
+
+    /* Fixed Huffman codes. */
+    for (i = 0; i < FIXED_LITLEN_CODES; i++)
+    {
+        fixedLitLens[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    }
+    for (i = 0; i < DIST_CODES; i++)
+    {
+        fixedDistLens[i] = 5;
+    }
+    fixedBits = 3 + extraBits;
+
+    for (i = 0; i < LITLEN_CODES; i++)
+    {
+        dynamicBits += (unsigned long) litFreq[i] * litLens[i];
+        fixedBits += (unsigned long) litFreq[i] * fixedLitLens[i];
+    }
+    for (i = 0; i < DIST_CODES; i++)
+    {
+        dynamicBits += (unsigned long) distFreq[i] * distLens[i];
+        fixedBits += (unsigned long) distFreq[i] * fixedDistLens[i];
+    }
+
+    storedBits = ((len + STORED_MAX - 1) / STORED_MAX + !len) * (3 + 7 + 32)
+        + (unsigned long) len * 8;
+
+    if (storedBits <= dynamicBits && storedBits <= fixedBits)
+    {
+        PutStored(d, data, len, last);
+    }
+    else if (fixedBits <= dynamicBits)
+    {
+        BuildCodes(fixedLitLens, FIXED_LITLEN_CODES, litCodes);
+        BuildCodes(fixedDistLens, DIST_CODES, distCodes);
+
+        PutBits(w, last, 1);
+        PutBits(w, 1, 2);
+        PutTokens(d, fixedLitLens, litCodes, fixedDistLens, distCodes);
+    }
+    else
+    {
+        BuildCodes(litLens, LITLEN_CODES, litCodes);
+        BuildCodes(distLens, DIST_CODES, distCodes);
+        BuildCodes(clenLens, CLEN_CODES, clenCodes);
+
+        PutBits(w, last, 1);
+        PutBits(w, 2, 2);
+        PutBits(w, hlit - 257, 5);
+        PutBits(w, hdist - 1, 5);
+        PutBits(w, hclen - 4, 4);
+
+        for (i = 0; i < (size_t) hclen; i++)
+        {
+            PutBits(w, clenLens[clenOrder[i]], 3);
+        }
+
+        for (i = 0; i < rleCount; i++)
+        {
+            PutBits(w, clenCodes[rle[i]], clenLens[rle[i]]);
+            if (rle[i] == 16)
+            {
+                PutBits(w, rleExtra[i], 2);
+            }
+            else if (rle[i] == 17)
+            {
+                PutBits(w, rleExtra[i], 3);
+            }
+            else if (rle[i] == 18)
+            {
+                PutBits(w, rleExtra[i], 7);
+            }
+        }
+
+        PutTokens(d, litLens, litCodes, distLens, distCodes);
+    }
+
+    d->tokens = 0;
+}
+
+static uint32_t
+Hash(unsigned char *p)
+{
+    uint32_t v = ((uint32_t) p[0] << 16) | ((uint32_t) p[1] << 8) | p[2];
+
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static void
+Insert(Deflater * d, unsigned char *data, size_t len, size_t pos)
+{
+    uint32_t h;
+
+    if (pos + MIN_MATCH > len)
+    {
+        return;
+    }
+
+    h = Hash(data + pos);
+    d->prev[pos & WINDOW_MASK] = d->head[h];
+    d->head[h] = pos;
+}
+
+/* Find the longest earlier match for the data at the given position,
+ * which must not have been inserted yet. */
+static int
+LongestMatch(Deflater * d, unsigned char *data, size_t len, size_t pos, int *distOut)
+{
+    int32_t cand;
+    int chain = d->maxChain;
+    int best = MIN_MATCH - 1;
+    size_t max = len - pos < MAX_MATCH ? len - pos : MAX_MATCH;
+
+    if (max < MIN_MATCH)
+    {
+        return 0;
+    }
+
+    cand = d->head[Hash(data + pos)];
+
+    while (cand >= 0 && pos - cand <= WINDOW_SIZE && chain--)
+    {
+        unsigned char *a = data + cand;
+        unsigned char *b = data + pos;
+        int32_t next;
+
+        if (a[best] == b[best] && a[0] == b[0] && a[1] == b[1])
+        {
+            size_t l = 2;
+
+            while (l < max && a[l] == b[l])
+            {
+                l++;
+            }
+
+            if ((int) l > best)
+            {
+                best = l;
+                *distOut = pos - cand;
+                if (best >= d->niceLength || (size_t) best == max)
+                {
+                    break;
+                }
+            }
+        }
+
+        next = d->prev[cand & WINDOW_MASK];
+        if (next >= cand)
+        {
+            break;
+        }
+        cand = next;
+    }
+
+    return best >= MIN_MATCH ? best : 0;
+}
+
+static void
+Compress(Deflater * d, unsigned char *data, size_t len)
+{
+    size_t blockStart = 0;
+    size_t pos = 0;
+
+    while (pos < len && !d->w.error)
+    {
+        int matchDist = 0;
+        int matchLen = LongestMatch(d, data, len, pos, &matchDist);
+        int inserted = 0;
+
+        /* See if waiting one byte would give a longer match. */
+        if (matchLen && d->lazy && matchLen < d->niceLength)
+        {
+            int nextDist = 0;
+            int nextLen;
+
+            Insert(d, data, len, pos);
+            inserted = 1;
+
+            nextLen = LongestMatch(d, data, len, pos + 1, &nextDist);
+            if (nextLen > matchLen)
+            {
+                d->lit[d->tokens] = data[pos];
+                d->dist[d->tokens++] = 0;
+                pos++;
+
+                matchLen = nextLen;
+                matchDist = nextDist;
+                inserted = 0;
+
+                if (d->tokens == BLOCK_TOKENS)
+                {
+                    PutBlock(d, data + blockStart, pos - blockStart, 0);
+                    blockStart = pos;
+                }
+            }
+        }
+
+        if (matchLen)
+        {
+            int i;
+
+            d->lit[d->tokens] = matchLen;
+            d->dist[d->tokens++] = matchDist;
+
+            for (i = inserted; i < matchLen; i++)
+            {
+                Insert(d, data, len, pos + i);
+            }
+            pos += matchLen;
+        }
+        else
+        {
+            Insert(d, data, len, pos);
+            d->lit[d->tokens] = data[pos];
+            d->dist[d->tokens++] = 0;
+            pos++;
+        }
+
+        if (d->tokens == BLOCK_TOKENS)
+        {
+            PutBlock(d, data + blockStart, pos - blockStart, 0);
+            blockStart = pos;
+        }
+    }
+
+    PutBlock(d, data + blockStart, len - blockStart, 1);
+}
+
+int
+DeflateCompress(DeflateFormat format, int level, unsigned char *data, size_t len,
+                IoWriteFunc * write, void *cookie)
+{
+    Deflater *d;
+    BitWriter *w;
+    uint32_t check;
+    int ok;
+
+    if (!write || (!data && len) || len > INT32_MAX)
+    {
+        return 0;
+    }
+
+    if (level < 1 || level > 9)
+    {
+        level = DEFLATE_DEFAULT_LEVEL;
+    }
+
+    d = Malloc(sizeof(Deflater));
+    if (!d)
+    {
+        return 0;
+    }
+
+    w = &d->w;
+    w->pos = 0;
+    w->bits = 0;
+    w->count = 0;
+    w->write = write;
+    w->cookie = cookie;
+    w->error = 0;
+
+    memset(d->head, 0xFF, sizeof(d->head));
+    d->tokens = 0;
+    d->maxChain = levelChain[level - 1];
+    d->niceLength = levelNice[level - 1];
+    d->lazy = level >= 4;
+
+    if (format == DEFLATE_GZIP)
+    {
+        static const unsigned char header[10] = {
+            0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 3
+        };
+        size_t i;
+
+        for (i = 0; i < sizeof(header); i++)
+        {
+            PutByte(w, header[i]);
+        }
+    }
+    else
+    {
+        PutByte(w, 0x78);
+        PutByte(w, 0x9C);
+    }
+
+    Compress(d, data, len);
+    PutAlign(w);
+
+    if (format == DEFLATE_GZIP)
+    {
+        check = Crc32(data, len);
+        PutByte(w, check & 0xFF);
+        PutByte(w, (check >> 8) & 0xFF);
+        PutByte(w, (check >> 16) & 0xFF);
+        PutByte(w, (check >> 24) & 0xFF);
+        PutByte(w, len & 0xFF);
+        PutByte(w, (len >> 8) & 0xFF);
+        PutByte(w, (len >> 16) & 0xFF);
+        PutByte(w, (len >> 24) & 0xFF);
+    }
+    else
+    {
+        check = Adler32(data, len);
+        PutByte(w, (check >> 24) & 0xFF);
+        PutByte(w, (check >> 16) & 0xFF);
+        PutByte(w, (check >> 8) & 0xFF);
+        PutByte(w, check & 0xFF);
+    }
+
+    WriterFlush(w);
+
+    ok = !w->error;
+    Free(d);
+
+    return ok;
+}
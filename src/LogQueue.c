@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <LogQueue.h>
+
+#include <Cytoplasm/Memory.h>
+#include <Cytoplasm/Io.h>
+#include <Cytoplasm/Str.h>
+#include <Cytoplasm/Util.h>
+
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define LOG_QUEUE_BATCH (64 * 1024)
+
+struct LogQueue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+
+    char *ring;
+    size_t size;
+    size_t start;
+    size_t len;
+
+    int block;
+    unsigned long dropped;
+    int stop;
+
+    pthread_t thread;
+    Stream *stream;
+
+    /* Only the writer thread touches these. */
+    char *path;
+    char *rotatedPath;
+    size_t rotatedSize;
+    int fd;
+    uint64_t rotateSize;
+    uint64_t rotateAge;
+    uint64_t written;
+    uint64_t opened;
+
+    char batch[LOG_QUEUE_BATCH];
+};
+
+static ssize_t
+QueueRead(void *cookie, void *buf, size_t n)
+{
+    (void) cookie;
+    (void) buf;
+    (void) n;
+
+    errno = EBADF;
+    return -1;
+}
+
+/*
+ * Called by the logging thread. This only copies the message into the
+ * ring buffer, so it never waits on the output, unless the buffer is
+ * full and the queue is set to block.
+ */
+static ssize_t
+QueueWrite(void *cookie, void *buf, size_t n)
+{
+    LogQueue *queue = cookie;
+    char *data = buf;
+    size_t end;
+    size_t first;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->size - queue->len < n)
+    {
+        /* A message that could never fit is always dropped, or the
+         * logging thread would wait forever. */
+        if (!queue->block || queue->stop || n > queue->size)
+        {
+            queue->dropped++;
+            pthread_mutex_unlock(&queue->lock);
+            return n;
+        }
+        pthread_cond_wait(&queue->notFull, &queue->lock);
+    }
+
+    end = (queue->start + queue->len) % queue->size;
+    first = queue->size - end < n ? queue->size - end : n;
+
+    memcpy(queue->ring + end, data, first);
+    memcpy(queue->ring, data + first, n - first);
+    queue->len += n;
+
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+
+    return n;
+}
+
+static off_t
+QueueSeek(void *cookie, off_t * off, int whence)
+{
+    (void) cookie;
+    (void) off;
+    (void) whence;
+
+    errno = ESPIPE;
+    return -1;
+}
+
+static int
+QueueClose(void *cookie)
+{
+    /* The queue is stopped by LogQueueFree(), not by closing the
+     * stream. */
+    (void) cookie;
+    return 0;
+}
+
+static void
+QueueOpen(LogQueue * queue)
+{
+    struct stat st;
+
+    queue->fd = open(queue->path, O_WRONLY | O_CREAT | O_APPEND, 0640);
+    queue->written = 0;
+    queue->opened = UtilTsMillis();
+
+    if (queue->fd >= 0 && fstat(queue->fd, &st) == 0)
+    {
+        queue->written = st.st_size;
+    }
+}
+
+static void
+QueueOutput(LogQueue * queue, char *data, size_t len)
+{
+    if (queue->fd < 0 && queue->path)
+    {
+        QueueOpen(queue);
+    }
+    if (queue->fd < 0)
+    {
+        return;
+    }
+
+    while (len)
+    {
+        ssize_t n = write(queue->fd, data, len);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+
+        data += n;
+        len -= n;
+        queue->written += n;
+    }
+}
+
+static void
+QueueRotate(LogQueue * queue)
+{
+    uint64_t now;
+
+    if (!queue->path || queue->fd < 0 || !queue->written)
+    {
+        return;
+    }
+
+    now = UtilTsMillis();
+    if ((!queue->rotateSize || queue->written < queue->rotateSize) &&
+        (!queue->rotateAge || now - queue->opened < queue->rotateAge * 1000))
+    {
+        return;
+    }
+
+    snprintf(queue->rotatedPath, queue->rotatedSize, "%s.%llu",
+             queue->path, (unsigned long long) now);
+
+    close(queue->fd);
+    rename(queue->path, queue->rotatedPath);
+    QueueOpen(queue);
+}
+
+static void *
+QueueThread(void *arg)
+{
+    LogQueue *queue = arg;
+
+    for (;;)
+    {
+        unsigned long dropped;
+        size_t n;
+        size_t first;
+
+        pthread_mutex_lock(&queue->lock);
+        if (!queue->len && !queue->stop)
+        {
+            if (queue->path && queue->rotateAge)
+            {
+                /* Wake up now and then so that an idle log still gets
+                 * rotated on time. */
+                struct timespec ts;
+
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += 1;
+                pthread_cond_timedwait(&queue->notEmpty, &queue->lock, &ts);
+            }
+            else
+            {
+                pthread_cond_wait(&queue->notEmpty, &queue->lock);
+            }
+        }
+
+        if (!queue->len)
+        {
+            int stop = queue->stop;
+
+            pthread_mutex_unlock(&queue->lock);
+            if (stop)
+            {
+                break;
+            }
+
+            QueueRotate(queue);
+            continue;
+        }
+
+        /* Take everything that's waiting, up to a batch, so that the
+         * lock is not held while writing. */
+        n = queue->len < LOG_QUEUE_BATCH ? queue->len : LOG_QUEUE_BATCH;
+        first = queue->size - queue->start < n ? queue->size - queue->start : n;
+
+        memcpy(queue->batch, queue->ring + queue->start, first);
+        memcpy(queue->batch + first, queue->ring, n - first);
+        queue->start = (queue->start + n) % queue->size;
+        queue->len -= n;
+
+        dropped = queue->dropped;
+        queue->dropped = 0;
+
+        pthread_cond_broadcast(&queue->notFull);
+        pthread_mutex_unlock(&queue->lock);
+
+        QueueOutput(queue, queue->batch, n);
+
+        if (dropped)
+        {
+            char msg[128];
+            int len = snprintf(msg, sizeof(msg),
+                               "%lu log messages were dropped because the log queue was full.\n",
+                               dropped);
+
+            QueueOutput(queue, msg, len);
+        }
+
+        QueueRotate(queue);
+    }
+
+    return NULL;
+}
+
+LogQueue *
+LogQueueCreate(char *path, size_t size, int block, uint64_t rotateSize, uint64_t rotateAge)
+{
+    LogQueue *queue;
+    IoFunctions funcs;
+    Io *io;
+
+    if (!size)
+    {
+        size = LOG_QUEUE_DEFAULT_SIZE;
+    }
+
+    queue = Malloc(sizeof(LogQueue));
+    if (!queue)
+    {
+        return NULL;
+    }
+
+    memset(queue, 0, sizeof(LogQueue));
+    queue->size = size;
+    queue->block = block;
+    queue->rotateSize = rotateSize;
+    queue->rotateAge = rotateAge;
+    queue->fd = STDOUT_FILENO;
+
+    queue->ring = Malloc(size);
+    if (!queue->ring)
+    {
+        goto error;
+    }
+
+    if (path)
+    {
+        queue->path = StrDuplicate(path);
+        queue->rotatedSize = strlen(path) + 32;
+        queue->rotatedPath = Malloc(queue->rotatedSize);
+        if (!queue->path || !queue->rotatedPath)
+        {
+            goto error;
+        }
+
+        QueueOpen(queue);
+        if (queue->fd < 0)
+        {
+            goto error;
+        }
+    }
+
+    funcs.read = QueueRead;
+    funcs.write = QueueWrite;
+    funcs.seek = QueueSeek;
+    funcs.close = QueueClose;
+
+    io = IoCreate(queue, funcs);
+    if (!io)
+    {
+        goto error;
+    }
+
+    queue->stream = StreamIo(io);
+    if (!queue->stream)
+    {
+        IoClose(io);
+        goto error;
+    }
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->notEmpty, NULL);
+    pthread_cond_init(&queue->notFull, NULL);
+
+    if (pthread_create(&queue->thread, NULL, QueueThread, queue) != 0)
+    {
+        pthread_mutex_destroy(&queue->lock);
+        pthread_cond_destroy(&queue->notEmpty);
+        pthread_cond_destroy(&queue->notFull);
+        StreamClose(queue->stream);
+        goto error;
+    }
+
+    return queue;
+
+error:
+    if (queue->path && queue->fd >= 0)
+    {
+        close(queue->fd);
+    }
+    Free(queue->rotatedPath);
+    Free(queue->path);
+    Free(queue->ring);
+    Free(queue);
+    return NULL;
+}
+
+Stream *
+LogQueueStream(LogQueue * queue)
+{
+    return queue ? queue->stream : NULL;
+}
+
+void
+LogQueueFree(LogQueue * queue)
+{
+    if (!queue)
+    {
+        return;
+    }
+
+    /* Closing the stream pushes anything it has buffered into the
+     * ring, which the thread then drains before it stops. */
+    StreamClose(queue->stream);
+
+    pthread_mutex_lock(&queue->lock);
+    queue->stop = 1;
+    pthread_cond_broadcast(&queue->notEmpty);
+    pthread_cond_broadcast(&queue->notFull);
+    pthread_mutex_unlock(&queue->lock);
+
+    pthread_join(queue->thread, NULL);
+
+    if (queue->path && queue->fd >= 0)
+    {
+        close(queue->fd);
+    }
+
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->notEmpty);
+    pthread_cond_destroy(&queue->notFull);
+
+    Free(queue->rotatedPath);
+    Free(queue->path);
+    Free(queue->ring);
+    Free(queue);
+}
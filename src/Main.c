@@ -52,6 +52,17 @@
 #include <Routes.h>
 #include <Uia.h>
 #include <Config.h>
+#include <TokenCache.h>
+#include <SignedToken.h>
+#include <TokenExpiry.h>
+#include <UserIndex.h>
+#include <Alias.h>
+#include <Deflate.h>
+#include <LogQueue.h>
+#include <Metrics.h>
+#include <Trace.h>
+#include <RateLimit.h>
+#include <Reaper.h>
 
 
 static Array *httpServers;
@@ -86,6 +97,38 @@ SignalHandler(int signal)
     }
 }
 
+/*
+ * Background jobs are run through these so that the time each run
+ * takes is recorded.
+ */
+static void
+JobUiaCleanup(void *args)
+{
+    uint64_t start = MetricsNow();
+
+    UiaCleanup(args);
+    MetricsJob("UiaCleanup", MetricsNow() - start);
+}
+
+static void
+JobTokenExpirySweep(void *db)
+{
+    uint64_t start = MetricsNow();
+
+    TokenExpirySweep(db);
+    MetricsJob("TokenExpirySweep", MetricsNow() - start);
+}
+
+static void
+JobRateLimitCompact(void *args)
+{
+    uint64_t start = MetricsNow();
+
+    (void) args;
+    RateLimitCompact();
+    MetricsJob("RateLimitCompact", MetricsNow() - start);
+}
+
 typedef enum ArgFlag
 {
     ARG_VERSION = (1 << 0),
@@ -105,7 +148,7 @@ Main(Array * args)
 
     /* Program configuration */
     Config tConfig;
-    Stream *logFile;
+    LogQueue *logQueue;
     Stream *pidFile;
 
     char *pidPath;
@@ -117,6 +160,7 @@ Main(Array * args)
     /* HTTP server management */
     size_t i;
     HttpServer *server;
+    MatrixListenerArgs *listenerArgs;
 
     /* Signal handling */
     struct sigaction sigAction;
@@ -137,7 +181,7 @@ start:
     exit = EXIT_SUCCESS;
     flags = 0;
     dbPath = NULL;
-    logFile = NULL;
+    logQueue = NULL;
     pidFile = NULL;
     pidPath = NULL;
     userInfo = NULL;
@@ -275,6 +319,14 @@ start:
         goto finish;
     }
 
+    matrixArgs.config = ConfigStoreCreate(DbJson(tConfig.ref));
+    if (!matrixArgs.config)
+    {
+        Log(LOG_ERR, "Unable to publish the configuration.");
+        exit = EXIT_FAILURE;
+        goto finish;
+    }
+
     if (!tConfig.log.timestampFormat || !StrEquals(tConfig.log.timestampFormat, "default"))
     {
         LogConfigTimeStampFormatSet(LogConfigGlobal(), tConfig.log.timestampFormat);
@@ -297,9 +349,12 @@ start:
 
     if (tConfig.log.output == CONFIG_LOG_OUTPUT_FILE)
     {
-        logFile = StreamOpen("telodendria.log", "a");
+        logQueue = LogQueueCreate("telodendria.log", tConfig.log.bufferSize,
+                                  tConfig.log.overflow == CONFIG_LOG_OVERFLOW_BLOCK,
+                                  tConfig.log.rotate.size,
+                                  tConfig.log.rotate.interval);
 
-        if (!logFile)
+        if (!logQueue)
         {
             Log(LOG_ERR, "Unable to open log file for appending.");
             exit = EXIT_FAILURE;
@@ -308,11 +363,30 @@ start:
         }
 
         Log(LOG_INFO, "Logging to the log file. Check there for all future messages.");
-        LogConfigOutputSet(LogConfigGlobal(), logFile);
+        LogConfigOutputSet(LogConfigGlobal(), LogQueueStream(logQueue));
     }
     else if (tConfig.log.output == CONFIG_LOG_OUTPUT_STDOUT)
     {
-        Log(LOG_DEBUG, "Already logging to standard output.");
+        /* A terminal is left alone so that it is written to as soon as
+         * a message is logged; anything else, such as a pipe to a
+         * service manager, goes through the queue. */
+        if (!isatty(STDOUT_FILENO))
+        {
+            logQueue = LogQueueCreate(NULL, tConfig.log.bufferSize,
+                                  tConfig.log.overflow == CONFIG_LOG_OVERFLOW_BLOCK,
+                                      0, 0);
+        }
+
+        if (logQueue)
+        {
+            StreamFlush(StreamStdout());
+            LogConfigOutputSet(LogConfigGlobal(), LogQueueStream(logQueue));
+            Log(LOG_DEBUG, "Logging to standard output through the log queue.");
+        }
+        else
+        {
+            Log(LOG_DEBUG, "Already logging to standard output.");
+        }
     }
     else if (tConfig.log.output == CONFIG_LOG_OUTPUT_SYSLOG)
     {
@@ -375,7 +449,7 @@ start:
         HttpServerConfig args;
 
         args.port = serverCfg->port;
-        args.threads = serverCfg->maxConnections;
+        args.threads = serverCfg->threads;
         args.maxConnections = serverCfg->maxConnections;
         args.tlsCert = serverCfg->tls.cert;
         args.tlsKey = serverCfg->tls.key;
@@ -389,11 +463,15 @@ start:
         Log(LOG_DEBUG, "Flags: %d", args.flags);
         Log(LOG_DEBUG, "TLS Cert: %s", serverCfg->tls.cert);
         Log(LOG_DEBUG, "TLS Key: %s", serverCfg->tls.key);
+        Log(LOG_DEBUG, "Compression: %s", serverCfg->compression.enabled ? "true" : "false");
+        Log(LOG_DEBUG, "Max Queue Delay: %ld ms", (long) serverCfg->admission.maxQueueDelay);
+        Log(LOG_DEBUG, "Max In Flight: %ld", (long) serverCfg->admission.maxInFlight);
+        Log(LOG_DEBUG, "Body Timeout: %ld ms", (long) serverCfg->timeouts.body);
+        Log(LOG_DEBUG, "Send Timeout: %ld ms", (long) serverCfg->timeouts.send);
         LogConfigUnindent(LogConfigGlobal());
 
 
         args.handler = MatrixHttpHandler;
-        args.handlerArgs = &matrixArgs;
 
         if (args.flags & HTTP_FLAG_TLS)
         {
@@ -412,16 +490,47 @@ start:
             }
         }
 
+        listenerArgs = Malloc(sizeof(MatrixListenerArgs));
+        if (!listenerArgs)
+        {
+            Log(LOG_ERR, "Error setting up HTTP server.");
+            exit = EXIT_FAILURE;
+            goto finish;
+        }
+
+        listenerArgs->matrixArgs = &matrixArgs;
+        listenerArgs->port = serverCfg->port;
+        listenerArgs->compressThreshold = 0;
+        listenerArgs->compressLevel = DEFLATE_DEFAULT_LEVEL;
+        if (serverCfg->compression.enabled)
+        {
+            listenerArgs->compressThreshold = serverCfg->compression.threshold;
+            listenerArgs->compressLevel = serverCfg->compression.level;
+        }
+        listenerArgs->maxQueueDelay = serverCfg->admission.maxQueueDelay;
+        listenerArgs->maxInFlight = serverCfg->admission.maxInFlight;
+        listenerArgs->inFlight = 0;
+        listenerArgs->bodyTimeout = serverCfg->timeouts.body > 0 ?
+                (long) serverCfg->timeouts.body : 0;
+        listenerArgs->sendTimeout = serverCfg->timeouts.send > 0 ?
+                (long) serverCfg->timeouts.send : 0;
+        pthread_mutex_init(&listenerArgs->lock, NULL);
+
+        args.handlerArgs = listenerArgs;
+
         server = HttpServerCreate(&args);
         if (!server)
         {
             Log(LOG_ERR, "Unable to create HTTP server on port %d: %s",
                 serverCfg->port, strerror(errno));
 
+            pthread_mutex_destroy(&listenerArgs->lock);
+            Free(listenerArgs);
             exit = EXIT_FAILURE;
             goto finish;
         }
         ArrayAdd(httpServers, server);
+        MetricsThreads(serverCfg->port, serverCfg->threads);
     }
 
     if (!ArraySize(httpServers))
@@ -500,8 +609,38 @@ start:
 
     DbMaxCacheSet(matrixArgs.db, tConfig.maxCache);
 
+    if (!SignedTokenInit(matrixArgs.db, tConfig.signedTokens))
+    {
+        Log(LOG_ERR, "Unable to set up signed access tokens.");
+        exit = EXIT_FAILURE;
+        goto finish;
+    }
+
+    UiaInit(matrixArgs.db, UIA_DEFAULT_MAX_SESSIONS, tConfig.persistUiaSessions);
+    TraceInit(tConfig.slowRequestThreshold);
+
     ConfigUnlock(&tConfig);
 
+    TokenCacheInit(TOKEN_CACHE_DEFAULT_SIZE);
+    RateLimitInit();
+
+    if (!ReaperInit())
+    {
+        Log(LOG_ERR, "Unable to start the connection deadline thread.");
+        exit = EXIT_FAILURE;
+        goto finish;
+    }
+
+    if (!AliasInit(matrixArgs.db))
+    {
+        Log(LOG_ERR, "Unable to set up the room alias store.");
+        exit = EXIT_FAILURE;
+        goto finish;
+    }
+
+    Log(LOG_NOTICE, "Building user directory index...");
+    UserIndexInit(matrixArgs.db);
+
     cron = CronCreate(60 * 1000);  /* 1-minute tick */
     if (!cron)
     {
@@ -512,7 +651,9 @@ start:
 
     Log(LOG_DEBUG, "Registering jobs...");
 
-    CronEvery(cron, 30 * 60 * 1000, (JobFunc *) UiaCleanup, &matrixArgs);
+    CronEvery(cron, 60 * 1000, JobUiaCleanup, &matrixArgs);
+    CronEvery(cron, 5 * 60 * 1000, JobTokenExpirySweep, matrixArgs.db);
+    CronEvery(cron, 60 * 1000, JobRateLimitCompact, NULL);
 
     Log(LOG_NOTICE, "Starting job scheduler...");
     CronStart(cron);
@@ -589,8 +730,11 @@ finish:
         {
             Log(LOG_DEBUG, "Freeing HTTP server %lu...", i);
             server = ArrayGet(httpServers, i);
+            listenerArgs = HttpServerConfigGet(server)->handlerArgs;
             HttpServerStop(server);
             HttpServerFree(server);
+            pthread_mutex_destroy(&listenerArgs->lock);
+            Free(listenerArgs);
             Log(LOG_DEBUG, "Freed HTTP server %lu.", i);
         }
         ArrayFree(httpServers);
@@ -599,6 +743,9 @@ finish:
         Log(LOG_DEBUG, "Freed HTTP servers array.");
     }
 
+    ReaperFree();
+    Log(LOG_DEBUG, "Stopped connection deadline thread.");
+
     if (cron)
     {
         Log(LOG_DEBUG, "Waiting on background jobs...");
@@ -607,9 +754,39 @@ finish:
         Log(LOG_DEBUG, "Stopped and freed job scheduler.");
     }
 
+    MetricsFree();
+    Log(LOG_DEBUG, "Freed metrics.");
+
     ConfigUnlock(&tConfig);
     Log(LOG_DEBUG, "Unlocked configuration.");
 
+    ConfigStoreFree(matrixArgs.config);
+    Log(LOG_DEBUG, "Freed configuration snapshot.");
+
+    TokenCacheFree();
+    Log(LOG_DEBUG, "Freed token cache.");
+
+    TraceFree();
+    Log(LOG_DEBUG, "Freed slow request traces.");
+
+    RateLimitFree();
+    Log(LOG_DEBUG, "Freed rate limit buckets.");
+
+    SignedTokenFree();
+    Log(LOG_DEBUG, "Freed signed token state.");
+
+    UserIndexFree();
+    Log(LOG_DEBUG, "Freed user directory index.");
+
+    AliasFree();
+    Log(LOG_DEBUG, "Freed room alias cache.");
+
+    UiaFree(matrixArgs.db);
+    Log(LOG_DEBUG, "Freed user interactive auth sessions.");
+
+    UserLockTableFree();
+    Log(LOG_DEBUG, "Freed user lock table.");
+
     DbClose(matrixArgs.db);
     Log(LOG_DEBUG, "Closed database.");
 
@@ -629,7 +806,12 @@ finish:
      */
     MemoryHook(NULL, NULL);
 
-    StreamClose(logFile);
+    if (logQueue)
+    {
+        /* Drains whatever is still queued before returning. */
+        LogConfigOutputSet(LogConfigGlobal(), StreamStdout());
+        LogQueueFree(logQueue);
+    }
 
     if (restart)
     {
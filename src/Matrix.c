@@ -27,6 +27,15 @@
 
 #include <string.h>
 #include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 
 #include <Cytoplasm/Memory.h>
 #include <Cytoplasm/HttpServer.h>
@@ -35,20 +44,296 @@
 
 #include <Cytoplasm/HttpRouter.h>
 #include <Routes.h>
+#include <Buffer.h>
+#include <Arena.h>
+#include <Deflate.h>
+#include <Metrics.h>
+#include <Trace.h>
+#include <RateLimit.h>
+#include <Reaper.h>
+#include <TokenCache.h>
+#include <SignedToken.h>
+
+/* Response buffers that grew past this are not kept for the next
+ * request, so one huge response doesn't pin its memory to a thread. */
+#define MATRIX_BUFFER_KEEP (256 * 1024)
+
+/* The size of the blocks that request temporaries are allocated
+ * from. */
+#define MATRIX_ARENA_BLOCK (16 * 1024)
+
+static pthread_key_t bufferKey;
+static pthread_key_t arenaKey;
+static pthread_key_t listenerKey;
+static pthread_once_t bufferOnce = PTHREAD_ONCE_INIT;
+
+static void
+BufferDestroy(void *buffer)
+{
+    BufferFree(buffer);
+}
+
+static void
+ArenaDestroy(void *arena)
+{
+    ArenaFree(arena);
+}
+
+static void
+BufferKeyCreate(void)
+{
+    pthread_key_create(&bufferKey, BufferDestroy);
+    pthread_key_create(&arenaKey, ArenaDestroy);
+    pthread_key_create(&listenerKey, NULL);
+}
+
+/* Get this thread's response buffer, emptied and ready for use. */
+static Buffer *
+ResponseBuffer(void)
+{
+    Buffer *buffer;
+
+    pthread_once(&bufferOnce, BufferKeyCreate);
+
+    buffer = pthread_getspecific(bufferKey);
+    if (buffer)
+    {
+        BufferReset(buffer);
+        return buffer;
+    }
+
+    buffer = BufferCreate();
+    if (buffer)
+    {
+        pthread_setspecific(bufferKey, buffer);
+    }
+
+    return buffer;
+}
+
+/* Get this thread's arena for request temporaries. It is reset once
+ * the response has been sent. */
+static Arena *
+RequestArena(void)
+{
+    Arena *arena;
+
+    pthread_once(&bufferOnce, BufferKeyCreate);
+
+    arena = pthread_getspecific(arenaKey);
+    if (arena)
+    {
+        return arena;
+    }
+
+    arena = ArenaCreate(MATRIX_ARENA_BLOCK);
+    if (arena)
+    {
+        pthread_setspecific(arenaKey, arena);
+    }
+
+    return arena;
+}
+
+static void
+ResponseBufferDone(Buffer * buffer)
+{
+    if (BufferLength(buffer) > MATRIX_BUFFER_KEEP)
+    {
+        pthread_setspecific(bufferKey, NULL);
+        BufferFree(buffer);
+    }
+}
+
+/*
+ * Pick the content coding for a response from the client's
+ * Accept-Encoding header, returning 0 if the client didn't ask for
+ * one that we support.
+ */
+static int
+NegotiateEncoding(HttpServerContext * context, DeflateFormat * format)
+{
+    char *header = HashMapGet(HttpRequestHeaders(context), "accept-encoding");
+    int gzip = 0;
+    int deflate = 0;
+
+    while (header && *header)
+    {
+        char *end = strchr(header, ',');
+        size_t len = end ? (size_t) (end - header) : strlen(header);
+        char coding[64];
+        char *name = coding;
+        char *params;
+        double q = 1;
+
+        if (len >= sizeof(coding))
+        {
+            len = sizeof(coding) - 1;
+        }
+        memcpy(coding, header, len);
+        coding[len] = '\0';
+
+        params = strchr(coding, ';');
+        if (params)
+        {
+            char *qParam = strstr(params + 1, "q=");
+
+            *params = '\0';
+            if (qParam)
+            {
+                q = strtod(qParam + 2, NULL);
+            }
+        }
+
+        while (isspace((unsigned char) *name))
+        {
+            name++;
+        }
+        len = strlen(name);
+        while (len && isspace((unsigned char) name[len - 1]))
+        {
+            name[--len] = '\0';
+        }
+
+        if (q > 0)
+        {
+            if (!strcasecmp(name, "gzip") || !strcasecmp(name, "x-gzip"))
+            {
+                gzip = 1;
+            }
+            else if (!strcasecmp(name, "deflate"))
+            {
+                deflate = 1;
+            }
+        }
+
+        header = end ? end + 1 : NULL;
+    }
+
+    if (gzip)
+    {
+        *format = DEFLATE_GZIP;
+        return 1;
+    }
+    if (deflate)
+    {
+        *format = DEFLATE_ZLIB;
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Write compressed output straight to the client. */
+static ssize_t
+CompressedWrite(void *cookie, void *buf, size_t len)
+{
+    if (BufferWriteBlock(cookie, buf, len) < 0)
+    {
+        return -1;
+    }
+
+    return len;
+}
+
+/*
+ * Get how long, in milliseconds, the request waited between arriving
+ * and being picked up by this thread, or -1 if that can't be told.
+ * The HTTP server doesn't say when it accepted the connection, but the
+ * client sends its request as soon as it connects, so the time since
+ * the kernel last received data on the socket is a close measure.
+ * This is only available on Linux, and not for TLS connections.
+ */
+static long
+QueueDelay(HttpServerContext * context)
+{
+#if defined(__linux__) && defined(TCP_INFO)
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    int fd = StreamFileno(HttpServerStream(context));
+
+    if (fd < 0 || getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0)
+    {
+        return -1;
+    }
+
+    return info.tcpi_last_data_recv;
+#else
+    (void) context;
+    return -1;
+#endif
+}
+
+/*
+ * Decide whether to handle a request, or to turn it away because the
+ * listener is overloaded. It is cheaper for everyone to fail a request
+ * straight away than to let it wait until the client times out and
+ * retries it.
+ */
+static int
+Admit(MatrixListenerArgs * listener, HttpServerContext * context)
+{
+    long queued = QueueDelay(context);
+    int admit = 1;
+
+    if (queued >= 0)
+    {
+        MetricsQueued(listener->port, (uint64_t) queued * 1000);
+        if (listener->maxQueueDelay &&
+            (unsigned long) queued > listener->maxQueueDelay)
+        {
+            admit = 0;
+        }
+    }
+
+    pthread_mutex_lock(&listener->lock);
+    if (admit && listener->maxInFlight &&
+        listener->inFlight >= listener->maxInFlight)
+    {
+        admit = 0;
+    }
+    if (admit)
+    {
+        listener->inFlight++;
+    }
+    pthread_mutex_unlock(&listener->lock);
+
+    if (!admit)
+    {
+        MetricsShed(listener->port);
+    }
+
+    return admit;
+}
 
 void
 MatrixHttpHandler(HttpServerContext * context, void *argp)
 {
-    MatrixHttpHandlerArgs *args = (MatrixHttpHandlerArgs *) argp;
+    MatrixListenerArgs *listener = argp;
+    MatrixHttpHandlerArgs *args = listener->matrixArgs;
     Stream *stream;
     HashMap *response = NULL;
 
     char *requestPath;
     RouteArgs routeArgs;
+    Buffer *body = NULL;
+    char contentLen[32];
+    DeflateFormat format;
+    uint64_t start = MetricsNow();
+    uint64_t phase;
+    int admitted = 0;
+    ReaperEntry deadline;
+
+    /* Let MatrixRequestJson() find the body timeout. */
+    pthread_once(&bufferOnce, BufferKeyCreate);
+    pthread_setspecific(listenerKey, listener);
 
     requestPath = HttpRequestPath(context);
     stream = HttpServerStream(context);
 
+    TraceBegin(HttpRequestMethodToString(HttpRequestMethodGet(context)),
+               requestPath);
+
     Log(LOG_DEBUG, "%s %s",
         HttpRequestMethodToString(HttpRequestMethodGet(context)),
         requestPath);
@@ -61,8 +346,17 @@ MatrixHttpHandler(HttpServerContext * context, void *argp)
     HttpResponseHeader(context, "Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS");
     HttpResponseHeader(context, "Access-Control-Allow-Headers", "X-Requested-With, Content-Type, Authorization");
 
+    /*
+     * The HTTP server closes the connection after every response, so
+     * say so. Compressed responses have no Content-Length, and rely
+     * on the connection closing to end the body.
+     */
     HttpResponseHeader(context, "Connection", "close");
 
+    MetricsActive(listener->port, 1);
+    routeArgs.route = NULL;
+    routeArgs.arena = NULL;
+
     /*
      * Web Browser Clients: Servers MUST expect that clients will approach them
      * with OPTIONS requests... the server MUST NOT perform any logic defined
@@ -73,46 +367,145 @@ MatrixHttpHandler(HttpServerContext * context, void *argp)
         HttpResponseStatus(context, HTTP_NO_CONTENT);
         HttpSendHeaders(context);
 
-        return;
+        goto finish;
+    }
+
+    admitted = Admit(listener, context);
+
+    body = ResponseBuffer();
+    if (!body)
+    {
+        HttpResponseStatus(context, HTTP_INTERNAL_SERVER_ERROR);
+        HttpResponseHeader(context, "Content-Length", "0");
+        HttpSendHeaders(context);
+        goto finish;
     }
 
     routeArgs.matrixArgs = args;
     routeArgs.context = context;
+    routeArgs.body = BufferStream(body);
+    routeArgs.arena = RequestArena();
+    if (!routeArgs.arena)
+    {
+        HttpResponseStatus(context, HTTP_INTERNAL_SERVER_ERROR);
+        HttpResponseHeader(context, "Content-Length", "0");
+        HttpSendHeaders(context);
+        goto finish;
+    }
 
-    if (!HttpRouterRoute(args->router, requestPath, &routeArgs, (void **) &response))
+    phase = MetricsNow();
+    if (!admitted)
     {
-        HttpResponseHeader(context, "Content-Type", "application/json");
-        HttpResponseStatus(context, HTTP_NOT_FOUND);
-        response = MatrixErrorCreate(M_NOT_FOUND, NULL);
+        HttpResponseStatus(context, HTTP_SERVICE_UNAVAILABLE);
+        HttpResponseHeader(context, "Retry-After", "1");
+        response = MatrixErrorCreate(M_LIMIT_EXCEEDED, NULL);
+        HashMapSet(response, "retry_after_ms", JsonValueInteger(1000));
+    }
+    else
+    {
+        response = MatrixRateLimit(context, args);
+        if (!response &&
+            !HttpRouterRoute(args->router, requestPath, &routeArgs, (void **) &response))
+        {
+            HttpResponseHeader(context, "Content-Type", "application/json");
+            HttpResponseStatus(context, HTTP_NOT_FOUND);
+            response = MatrixErrorCreate(M_NOT_FOUND, NULL);
+        }
     }
+    TracePhase("handler", MetricsNow() - phase);
 
     /*
-     * If the route handler returned a JSON object, take care
-     * of sending it here.
+     * If the route handler returned a JSON object, encode it into the
+     * buffer, so that it is only encoded once.
      *
-     * Otherwise, if the route handler returned NULL, assume
-     * that it sent its own headers and and body.
+     * Otherwise, if the route handler returned NULL, it set its own
+     * headers and already wrote its body into the buffer.
+     *
+     * Either way, the body can now be sent with the right length.
      */
     if (response)
     {
-        char *contentLen = StrInt(JsonEncode(response, NULL, JSON_DEFAULT));
+        phase = MetricsNow();
+        JsonEncode(response, routeArgs.body, JSON_DEFAULT);
+        StreamPutc(routeArgs.body, '\n');
+        JsonFree(response);
+        TracePhase("encode", MetricsNow() - phase);
 
         HttpResponseHeader(context, "Content-Type", "application/json");
+    }
+
+    if (listener->compressThreshold)
+    {
+        HttpResponseHeader(context, "Vary", "Accept-Encoding");
+    }
+
+    /*
+     * Large bodies are compressed straight onto the connection. The
+     * compressed length isn't known until it has all been written, so
+     * the body is sent without a Content-Length, and ends when the
+     * connection is closed.
+     */
+    phase = MetricsNow();
+    ReaperArm(&deadline, StreamFileno(stream), REAPER_SEND, listener->sendTimeout);
+    if (listener->compressThreshold &&
+        BufferLength(body) >= listener->compressThreshold &&
+        NegotiateEncoding(context, &format))
+    {
+        HttpResponseHeader(context, "Content-Encoding",
+                           format == DEFLATE_GZIP ? "gzip" : "deflate");
+        HttpSendHeaders(context);
+
+        /* If compression fails part-way, the connection is closed on
+         * whatever was sent; the compressed stream is left unfinished,
+         * so the client can't decode it as a complete body. */
+        if (!DeflateCompress(format, listener->compressLevel,
+                             (unsigned char *) BufferData(body), BufferLength(body),
+                             CompressedWrite, stream))
+        {
+            Log(LOG_WARNING, "Failed to send compressed response to %s; "
+                "closing the connection without ending the body.", requestPath);
+        }
+    }
+    else
+    {
+        snprintf(contentLen, sizeof(contentLen), "%lu", (unsigned long) BufferLength(body));
         HttpResponseHeader(context, "Content-Length", contentLen);
         HttpSendHeaders(context);
 
-        Free(contentLen);
+        BufferSend(body, stream);
+    }
 
-        JsonEncode(response, stream, JSON_DEFAULT);
-        JsonFree(response);
-        StreamPrintf(stream, "\n");
+    /* Flush here, so that a client that doesn't read the response is
+     * still covered by the deadline. */
+    StreamFlush(stream);
+    if (ReaperDisarm(&deadline))
+    {
+        Log(LOG_WARNING, "Timed out sending response to %s.", requestPath);
     }
+    TracePhase("send", MetricsNow() - phase);
+
+    ResponseBufferDone(body);
 
     Log(LOG_INFO, "%s %s (%d %s)",
         HttpRequestMethodToString(HttpRequestMethodGet(context)),
         requestPath,
         HttpResponseStatusGet(context),
         HttpStatusToString(HttpResponseStatusGet(context)));
+
+finish:
+    if (admitted)
+    {
+        pthread_mutex_lock(&listener->lock);
+        listener->inFlight--;
+        pthread_mutex_unlock(&listener->lock);
+    }
+
+    pthread_setspecific(listenerKey, NULL);
+    ArenaReset(routeArgs.arena);
+    TraceEnd(routeArgs.route, HttpResponseStatusGet(context));
+    MetricsRequest(routeArgs.route, HttpResponseStatusGet(context),
+                   MetricsNow() - start);
+    MetricsActive(listener->port, -1);
 }
 
 HashMap *
@@ -324,13 +717,189 @@ MatrixGetAccessToken(HttpServerContext * context, char **accessToken)
     return NULL;
 }
 
+/* Paths that are limited by the login budget rather than the general
+ * one, because they check passwords or start new sessions. */
+static char *loginPaths[] = {
+    "/_matrix/client/v3/login",
+    "/_matrix/client/v3/register",
+    "/_matrix/client/v1/register/",
+    "/_matrix/client/v3/account/password",
+    "/_matrix/client/v3/account/deactivate",
+    "/_matrix/client/v3/auth/",
+    NULL
+};
+
+/* Get the address the request came from. */
+static void
+RemoteAddress(HttpServerContext * context, int trustForwardedFor,
+              char *addr, size_t size)
+{
+    struct sockaddr_storage peer;
+    socklen_t len = sizeof(peer);
+    int fd = StreamFileno(HttpServerStream(context));
+
+    if (trustForwardedFor)
+    {
+        char *forwarded = HashMapGet(HttpRequestHeaders(context), "x-forwarded-for");
+
+        if (forwarded)
+        {
+            /* Each proxy appends the address it got the request from,
+             * so only the last one was added by our proxy; anything
+             * before it is whatever the client sent. */
+            char *last = strrchr(forwarded, ',');
+            size_t n;
+
+            if (last)
+            {
+                forwarded = last + 1;
+            }
+            n = strlen(forwarded);
+
+            while (n && isspace((unsigned char) *forwarded))
+            {
+                forwarded++;
+                n--;
+            }
+            while (n && isspace((unsigned char) forwarded[n - 1]))
+            {
+                n--;
+            }
+            if (n >= size)
+            {
+                n = size - 1;
+            }
+
+            memcpy(addr, forwarded, n);
+            addr[n] = '\0';
+            return;
+        }
+    }
+
+    strncpy(addr, "unknown", size);
+    addr[size - 1] = '\0';
+
+    if (fd < 0 || getpeername(fd, (struct sockaddr *) &peer, &len) != 0)
+    {
+        return;
+    }
+
+    if (peer.ss_family == AF_INET)
+    {
+        inet_ntop(AF_INET, &((struct sockaddr_in *) &peer)->sin_addr, addr, size);
+    }
+    else if (peer.ss_family == AF_INET6)
+    {
+        inet_ntop(AF_INET6, &((struct sockaddr_in6 *) &peer)->sin6_addr, addr, size);
+    }
+}
+
+/*
+ * Get the user that made the request, but only if that can be found
+ * out without going to the database, so that rate limiting never adds
+ * a database lookup to a request.
+ */
+static char *
+RequestUser(HttpServerContext * context)
+{
+    char *token = HashMapGet(HttpRequestHeaders(context), "authorization");
+    TokenCacheInfo info;
+    char *user = NULL;
+
+    if (!token || strncmp(token, "Bearer ", 7) != 0)
+    {
+        return NULL;
+    }
+    token += 7;
+
+    if (SignedTokenIs(token))
+    {
+        char *deviceId = NULL;
+        uint64_t expires;
+
+        if (SignedTokenVerify(token, &user, &deviceId, &expires))
+        {
+            Free(deviceId);
+            return user;
+        }
+        return NULL;
+    }
+
+    if (TokenCacheGet(token, &info) == TOKEN_CACHE_HIT)
+    {
+        user = info.user;
+        info.user = NULL;
+        TokenCacheInfoFree(&info);
+    }
+
+    return user;
+}
+
 HashMap *
-MatrixRateLimit(HttpServerContext * context, Db * db)
+MatrixRateLimit(HttpServerContext * context, MatrixHttpHandlerArgs * args)
 {
-    /* TODO: Implement rate limiting */
-    (void) context;
-    (void) db;
-    return NULL;
+    Config *config;
+    ConfigRateLimitBudget *budget;
+    char *path = HttpRequestPath(context);
+    char *class = "general";
+    char addr[INET6_ADDRSTRLEN + 1];
+    char *user;
+    char *key;
+    char retryAfter[32];
+    uint64_t wait;
+    HashMap *response;
+    size_t i;
+
+    config = ConfigAcquire(args->config);
+    if (!config || !config->rateLimit.enabled)
+    {
+        ConfigRelease(args->config, config);
+        return NULL;
+    }
+
+    budget = &config->rateLimit.general;
+    for (i = 0; loginPaths[i]; i++)
+    {
+        if (path && strncmp(path, loginPaths[i], strlen(loginPaths[i])) == 0)
+        {
+            budget = &config->rateLimit.login;
+            class = "login";
+            break;
+        }
+    }
+
+    RemoteAddress(context, config->rateLimit.trustForwardedFor, addr, sizeof(addr));
+
+    key = StrConcat(3, class, "|addr|", addr);
+    wait = RateLimitTake(key, budget->perMinute, budget->burst);
+    Free(key);
+
+    user = wait ? NULL : RequestUser(context);
+    if (user)
+    {
+        key = StrConcat(3, class, "|user|", user);
+        wait = RateLimitTake(key, budget->perMinute, budget->burst);
+        Free(key);
+        Free(user);
+    }
+
+    ConfigRelease(args->config, config);
+
+    if (!wait)
+    {
+        return NULL;
+    }
+
+    snprintf(retryAfter, sizeof(retryAfter), "%lu",
+             (unsigned long) ((wait + 999) / 1000));
+
+    HttpResponseStatus(context, HTTP_TOO_MANY_REQUESTS);
+    HttpResponseHeader(context, "Retry-After", retryAfter);
+
+    response = MatrixErrorCreate(M_LIMIT_EXCEEDED, NULL);
+    HashMapSet(response, "retry_after_ms", JsonValueInteger(wait));
+
+    return response;
 }
 
 HashMap *
@@ -360,3 +929,31 @@ MatrixClientWellKnown(char *base, char *identity)
 
     return response;
 }
+
+HashMap *
+MatrixRequestJson(HttpServerContext * context)
+{
+    uint64_t start = MetricsNow();
+    MatrixListenerArgs *listener;
+    ReaperEntry deadline;
+    HashMap *request;
+
+    pthread_once(&bufferOnce, BufferKeyCreate);
+    listener = pthread_getspecific(listenerKey);
+
+    ReaperArm(&deadline, StreamFileno(HttpServerStream(context)), REAPER_BODY,
+              listener ? listener->bodyTimeout : 0);
+    request = JsonDecode(HttpServerStream(context));
+    if (ReaperDisarm(&deadline))
+    {
+        Log(LOG_WARNING, "Timed out reading request body.");
+        if (request)
+        {
+            JsonFree(request);
+            request = NULL;
+        }
+    }
+
+    TracePhase("decode", MetricsNow() - start);
+    return request;
+}
@@ -0,0 +1,684 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <Metrics.h>
+
+#include <Cytoplasm/Memory.h>
+#include <Cytoplasm/HashMap.h>
+#include <Cytoplasm/Array.h>
+#include <Cytoplasm/Json.h>
+#include <Cytoplasm/Str.h>
+
+#include <TokenCache.h>
+#include <Reaper.h>
+
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#define METRICS_BUCKETS 11
+
+#define METRICS_STATUS_MIN 100
+#define METRICS_STATUS_MAX 599
+
+/* Histogram bucket bounds, in microseconds and as exported. */
+static const uint64_t bucketBounds[METRICS_BUCKETS] = {
+    5000, 10000, 25000, 50000, 100000, 250000,
+    500000, 1000000, 2500000, 5000000, 10000000
+};
+
+static const char *bucketNames[METRICS_BUCKETS] = {
+    "0.005", "0.01", "0.025", "0.05", "0.1", "0.25",
+    "0.5", "1", "2.5", "5", "10"
+};
+
+typedef struct MetricsHistogram
+{
+    /* Not cumulative; that is done when they are exported. */
+    uint64_t buckets[METRICS_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+} MetricsHistogram;
+
+typedef struct MetricsShard
+{
+    pthread_mutex_t lock;
+
+    HashMap *routes;               /* MetricsHistogram */
+    HashMap *jobs;                 /* MetricsHistogram */
+    HashMap *active;               /* int64_t */
+    HashMap *queued;               /* MetricsHistogram */
+    HashMap *shed;                 /* int64_t */
+    uint64_t status[METRICS_STATUS_MAX - METRICS_STATUS_MIN + 1];
+
+    struct MetricsShard *next;
+} MetricsShard;
+
+typedef struct MetricsPattern
+{
+    char *route;
+    char *pattern;
+} MetricsPattern;
+
+static pthread_mutex_t registryLock = PTHREAD_MUTEX_INITIALIZER;
+static MetricsShard *shards;
+static Array *patterns;
+static HashMap *threads;           /* int64_t */
+
+static pthread_key_t shardKey;
+static pthread_once_t shardOnce = PTHREAD_ONCE_INIT;
+
+static void
+ShardKeyCreate(void)
+{
+    /* No destructor; a thread's counters outlive it. */
+    pthread_key_create(&shardKey, NULL);
+}
+
+/* Get the calling thread's counters, creating them the first time. */
+static MetricsShard *
+ShardGet(void)
+{
+    MetricsShard *shard;
+
+    pthread_once(&shardOnce, ShardKeyCreate);
+
+    shard = pthread_getspecific(shardKey);
+    if (shard)
+    {
+        return shard;
+    }
+
+    shard = Malloc(sizeof(MetricsShard));
+    if (!shard)
+    {
+        return NULL;
+    }
+
+    memset(shard, 0, sizeof(MetricsShard));
+    shard->routes = HashMapCreate();
+    shard->jobs = HashMapCreate();
+    shard->active = HashMapCreate();
+    shard->queued = HashMapCreate();
+    shard->shed = HashMapCreate();
+    if (!shard->routes || !shard->jobs || !shard->active ||
+        !shard->queued || !shard->shed)
+    {
+        HashMapFree(shard->routes);
+        HashMapFree(shard->jobs);
+        HashMapFree(shard->active);
+        HashMapFree(shard->queued);
+        HashMapFree(shard->shed);
+        Free(shard);
+        return NULL;
+    }
+
+    pthread_mutex_init(&shard->lock, NULL);
+
+    pthread_mutex_lock(&registryLock);
+    shard->next = shards;
+    shards = shard;
+    pthread_mutex_unlock(&registryLock);
+
+    pthread_setspecific(shardKey, shard);
+    return shard;
+}
+
+static MetricsHistogram *
+HistogramGet(HashMap * map, char *name)
+{
+    MetricsHistogram *histogram = HashMapGet(map, name);
+
+    if (histogram)
+    {
+        return histogram;
+    }
+
+    histogram = Malloc(sizeof(MetricsHistogram));
+    if (!histogram)
+    {
+        return NULL;
+    }
+
+    memset(histogram, 0, sizeof(MetricsHistogram));
+    HashMapSet(map, name, histogram);
+    return histogram;
+}
+
+static void
+HistogramObserve(HashMap * map, char *name, uint64_t usec)
+{
+    MetricsHistogram *histogram = HistogramGet(map, name);
+    size_t i;
+
+    if (!histogram)
+    {
+        return;
+    }
+
+    for (i = 0; i < METRICS_BUCKETS; i++)
+    {
+        if (usec <= bucketBounds[i])
+        {
+            histogram->buckets[i]++;
+            break;
+        }
+    }
+
+    histogram->count++;
+    histogram->sum += usec;
+}
+
+static void
+HistogramMerge(HashMap * dst, HashMap * src)
+{
+    char *name;
+    MetricsHistogram *from;
+
+    while (HashMapIterate(src, &name, (void **) &from))
+    {
+        MetricsHistogram *to = HistogramGet(dst, name);
+        size_t i;
+
+        if (!to)
+        {
+            continue;
+        }
+
+        for (i = 0; i < METRICS_BUCKETS; i++)
+        {
+            to->buckets[i] += from->buckets[i];
+        }
+        to->count += from->count;
+        to->sum += from->sum;
+    }
+}
+
+static void
+MapFree(HashMap * map)
+{
+    char *key;
+    void *val;
+
+    while (HashMapIterate(map, &key, &val))
+    {
+        Free(val);
+    }
+    HashMapFree(map);
+}
+
+/* Write a label value, escaped as the exposition format requires. */
+static void
+LabelWrite(Stream * out, char *val)
+{
+    for (; *val; val++)
+    {
+        switch (*val)
+        {
+            case '\\':
+                StreamPuts(out, "\\\\");
+                break;
+            case '"':
+                StreamPuts(out, "\\\"");
+                break;
+            case '\n':
+                StreamPuts(out, "\\n");
+                break;
+            default:
+                StreamPutc(out, *val);
+                break;
+        }
+    }
+}
+
+static void
+HistogramWrite(Stream * out, char *metric, char *label, HashMap * map)
+{
+    char *name;
+    MetricsHistogram *histogram;
+
+    while (HashMapIterate(map, &name, (void **) &histogram))
+    {
+        uint64_t cumulative = 0;
+        size_t i;
+
+        for (i = 0; i < METRICS_BUCKETS; i++)
+        {
+            cumulative += histogram->buckets[i];
+
+            StreamPrintf(out, "%s_bucket{%s=\"", metric, label);
+            LabelWrite(out, name);
+            StreamPrintf(out, "\",le=\"%s\"} %llu\n", bucketNames[i],
+                         (unsigned long long) cumulative);
+        }
+
+        StreamPrintf(out, "%s_bucket{%s=\"", metric, label);
+        LabelWrite(out, name);
+        StreamPrintf(out, "\",le=\"+Inf\"} %llu\n",
+                     (unsigned long long) histogram->count);
+
+        StreamPrintf(out, "%s_sum{%s=\"", metric, label);
+        LabelWrite(out, name);
+        StreamPrintf(out, "\"} %.6f\n", histogram->sum / 1000000.0);
+
+        StreamPrintf(out, "%s_count{%s=\"", metric, label);
+        LabelWrite(out, name);
+        StreamPrintf(out, "\"} %llu\n", (unsigned long long) histogram->count);
+    }
+}
+
+static void
+AllocationCount(MemoryInfo * info, void *argp)
+{
+    size_t *count = argp;
+
+    (void) info;
+    (*count)++;
+}
+
+uint64_t
+MetricsNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void
+MetricsRequest(char *route, int status, uint64_t usec)
+{
+    MetricsShard *shard = ShardGet();
+
+    if (!shard)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&shard->lock);
+    HistogramObserve(shard->routes, route ? route : "none", usec);
+    if (status >= METRICS_STATUS_MIN && status <= METRICS_STATUS_MAX)
+    {
+        shard->status[status - METRICS_STATUS_MIN]++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/* Add to a per-listener counter. The shard must be locked. */
+static void
+CounterAdd(HashMap * map, int port, int64_t delta)
+{
+    char key[16];
+    int64_t *counter;
+
+    snprintf(key, sizeof(key), "%d", port);
+
+    counter = HashMapGet(map, key);
+    if (!counter)
+    {
+        counter = Malloc(sizeof(int64_t));
+        if (!counter)
+        {
+            return;
+        }
+        *counter = 0;
+        HashMapSet(map, key, counter);
+    }
+
+    *counter += delta;
+}
+
+/* Add up per-listener counters from a shard. */
+static void
+CounterMerge(HashMap * dst, HashMap * src)
+{
+    char *key;
+    int64_t *val;
+
+    while (HashMapIterate(src, &key, (void **) &val))
+    {
+        int64_t *total = HashMapGet(dst, key);
+
+        if (!total)
+        {
+            total = Malloc(sizeof(int64_t));
+            if (!total)
+            {
+                continue;
+            }
+            *total = 0;
+            HashMapSet(dst, key, total);
+        }
+        *total += *val;
+    }
+}
+
+void
+MetricsActive(int port, int delta)
+{
+    MetricsShard *shard = ShardGet();
+
+    if (!shard)
+    {
+        return;
+    }
+
+    /* Requests start and finish on the same thread, so the sum over
+     * all threads is the number in flight. */
+    pthread_mutex_lock(&shard->lock);
+    CounterAdd(shard->active, port, delta);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void
+MetricsThreads(int port, unsigned int count)
+{
+    pthread_mutex_lock(&registryLock);
+    if (!threads)
+    {
+        threads = HashMapCreate();
+    }
+    if (threads)
+    {
+        CounterAdd(threads, port, count);
+    }
+    pthread_mutex_unlock(&registryLock);
+}
+
+void
+MetricsQueued(int port, uint64_t usec)
+{
+    MetricsShard *shard = ShardGet();
+    char key[16];
+
+    if (!shard)
+    {
+        return;
+    }
+
+    snprintf(key, sizeof(key), "%d", port);
+
+    pthread_mutex_lock(&shard->lock);
+    HistogramObserve(shard->queued, key, usec);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void
+MetricsShed(int port)
+{
+    MetricsShard *shard = ShardGet();
+
+    if (!shard)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&shard->lock);
+    CounterAdd(shard->shed, port, 1);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void
+MetricsJob(char *job, uint64_t usec)
+{
+    MetricsShard *shard = ShardGet();
+
+    if (!shard)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&shard->lock);
+    HistogramObserve(shard->jobs, job, usec);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void
+MetricsRouteAdd(char *route, char *pattern)
+{
+    MetricsPattern *entry = Malloc(sizeof(MetricsPattern));
+
+    if (!entry)
+    {
+        return;
+    }
+
+    entry->route = route;
+    entry->pattern = pattern;
+
+    pthread_mutex_lock(&registryLock);
+    if (!patterns)
+    {
+        patterns = ArrayCreate();
+    }
+    if (!patterns || !ArrayAdd(patterns, entry))
+    {
+        Free(entry);
+    }
+    pthread_mutex_unlock(&registryLock);
+}
+
+void
+MetricsWrite(Stream * out)
+{
+    static char *cacheFields[] = {
+        "hits", "misses", "unknown_hits", "evictions", "entries", NULL
+    };
+
+    HashMap *routes = HashMapCreate();
+    HashMap *jobs = HashMapCreate();
+    HashMap *active = HashMapCreate();
+    HashMap *queued = HashMapCreate();
+    HashMap *shed = HashMapCreate();
+    uint64_t status[METRICS_STATUS_MAX - METRICS_STATUS_MIN + 1];
+    HashMap *cache;
+    MetricsShard *shard;
+    size_t allocations = 0;
+    char *key;
+    int64_t *val;
+    size_t i;
+
+    if (!out || !routes || !jobs || !active || !queued || !shed)
+    {
+        HashMapFree(routes);
+        HashMapFree(jobs);
+        HashMapFree(active);
+        HashMapFree(queued);
+        HashMapFree(shed);
+        return;
+    }
+
+    memset(status, 0, sizeof(status));
+
+    StreamPuts(out, "# HELP telodendria_http_route_info The path patterns each route is registered under.\n");
+    StreamPuts(out, "# TYPE telodendria_http_route_info gauge\n");
+
+    pthread_mutex_lock(&registryLock);
+    for (i = 0; i < ArraySize(patterns); i++)
+    {
+        MetricsPattern *entry = ArrayGet(patterns, i);
+
+        StreamPuts(out, "telodendria_http_route_info{route=\"");
+        LabelWrite(out, entry->route);
+        StreamPuts(out, "\",pattern=\"");
+        LabelWrite(out, entry->pattern);
+        StreamPuts(out, "\"} 1\n");
+    }
+
+    StreamPuts(out, "# HELP telodendria_http_threads Worker threads, by listener port.\n");
+    StreamPuts(out, "# TYPE telodendria_http_threads gauge\n");
+    while (threads && HashMapIterate(threads, &key, (void **) &val))
+    {
+        StreamPrintf(out, "telodendria_http_threads{port=\"%s\"} %lld\n",
+                     key, (long long) *val);
+    }
+
+    for (shard = shards; shard; shard = shard->next)
+    {
+        pthread_mutex_lock(&shard->lock);
+
+        HistogramMerge(routes, shard->routes);
+        HistogramMerge(jobs, shard->jobs);
+        HistogramMerge(queued, shard->queued);
+        CounterMerge(active, shard->active);
+        CounterMerge(shed, shard->shed);
+
+        for (i = 0; i <= METRICS_STATUS_MAX - METRICS_STATUS_MIN; i++)
+        {
+            status[i] += shard->status[i];
+        }
+
+        pthread_mutex_unlock(&shard->lock);
+    }
+    pthread_mutex_unlock(&registryLock);
+
+    StreamPuts(out, "# HELP telodendria_http_request_duration_seconds Time taken to handle requests, by route.\n");
+    StreamPuts(out, "# TYPE telodendria_http_request_duration_seconds histogram\n");
+    HistogramWrite(out, "telodendria_http_request_duration_seconds", "route", routes);
+
+    StreamPuts(out, "# HELP telodendria_http_responses_total Responses sent, by status code.\n");
+    StreamPuts(out, "# TYPE telodendria_http_responses_total counter\n");
+    for (i = 0; i <= METRICS_STATUS_MAX - METRICS_STATUS_MIN; i++)
+    {
+        if (status[i])
+        {
+            StreamPrintf(out, "telodendria_http_responses_total{code=\"%d\"} %llu\n",
+                         (int) i + METRICS_STATUS_MIN,
+                         (unsigned long long) status[i]);
+        }
+    }
+
+    StreamPuts(out, "# HELP telodendria_http_active_requests Requests in flight, by listener port.\n");
+    StreamPuts(out, "# TYPE telodendria_http_active_requests gauge\n");
+    while (HashMapIterate(active, &key, (void **) &val))
+    {
+        StreamPrintf(out, "telodendria_http_active_requests{port=\"%s\"} %lld\n",
+                     key, (long long) *val);
+    }
+
+    StreamPuts(out, "# HELP telodendria_http_queue_seconds Time requests waited to be picked up, by listener port.\n");
+    StreamPuts(out, "# TYPE telodendria_http_queue_seconds histogram\n");
+    HistogramWrite(out, "telodendria_http_queue_seconds", "port", queued);
+
+    StreamPuts(out, "# HELP telodendria_http_shed_total Requests turned away because the listener was overloaded.\n");
+    StreamPuts(out, "# TYPE telodendria_http_shed_total counter\n");
+    while (HashMapIterate(shed, &key, (void **) &val))
+    {
+        StreamPrintf(out, "telodendria_http_shed_total{port=\"%s\"} %lld\n",
+                     key, (long long) *val);
+    }
+
+    StreamPuts(out, "# HELP telodendria_http_reaped_total Connections shut down because a deadline passed, by what they were doing.\n");
+    StreamPuts(out, "# TYPE telodendria_http_reaped_total counter\n");
+    for (i = 0; i < REAPER_STATES; i++)
+    {
+        StreamPrintf(out, "telodendria_http_reaped_total{state=\"%s\"} %llu\n",
+                     ReaperStateToString((ReaperState) i),
+                     (unsigned long long) ReaperCount((ReaperState) i));
+    }
+
+    StreamPuts(out, "# HELP telodendria_job_duration_seconds Time taken by background jobs.\n");
+    StreamPuts(out, "# TYPE telodendria_job_duration_seconds histogram\n");
+    HistogramWrite(out, "telodendria_job_duration_seconds", "job", jobs);
+
+    cache = TokenCacheStats();
+    if (cache)
+    {
+        for (i = 0; cacheFields[i]; i++)
+        {
+            JsonValue *field = HashMapGet(cache, cacheFields[i]);
+            int gauge = StrEquals(cacheFields[i], "entries");
+
+            StreamPrintf(out, "# TYPE telodendria_token_cache_%s%s %s\n",
+                         cacheFields[i], gauge ? "" : "_total",
+                         gauge ? "gauge" : "counter");
+            StreamPrintf(out, "telodendria_token_cache_%s%s %lld\n",
+                         cacheFields[i], gauge ? "" : "_total",
+                         (long long) (field ? JsonValueAsInteger(field) : 0));
+        }
+        JsonFree(cache);
+    }
+
+    MemoryIterate(AllocationCount, &allocations);
+
+    StreamPuts(out, "# HELP telodendria_memory_allocated_bytes Memory currently allocated.\n");
+    StreamPuts(out, "# TYPE telodendria_memory_allocated_bytes gauge\n");
+    StreamPrintf(out, "telodendria_memory_allocated_bytes %lu\n",
+                 (unsigned long) MemoryAllocated());
+
+    StreamPuts(out, "# HELP telodendria_memory_allocations Live allocations.\n");
+    StreamPuts(out, "# TYPE telodendria_memory_allocations gauge\n");
+    StreamPrintf(out, "telodendria_memory_allocations %lu\n", (unsigned long) allocations);
+
+    MapFree(routes);
+    MapFree(jobs);
+    MapFree(active);
+    MapFree(queued);
+    MapFree(shed);
+}
+
+void
+MetricsFree(void)
+{
+    MetricsShard *shard;
+    size_t i;
+
+    pthread_mutex_lock(&registryLock);
+
+    shard = shards;
+    while (shard)
+    {
+        MetricsShard *next = shard->next;
+
+        MapFree(shard->routes);
+        MapFree(shard->jobs);
+        MapFree(shard->active);
+        MapFree(shard->queued);
+        MapFree(shard->shed);
+        pthread_mutex_destroy(&shard->lock);
+        Free(shard);
+
+        shard = next;
+    }
+    shards = NULL;
+
+    for (i = 0; i < ArraySize(patterns); i++)
+    {
+        Free(ArrayGet(patterns, i));
+    }
+    ArrayFree(patterns);
+    patterns = NULL;
+
+    if (threads)
+    {
+        MapFree(threads);
+        threads = NULL;
+    }
+
+    pthread_once(&shardOnce, ShardKeyCreate);
+    pthread_setspecific(shardKey, NULL);
+
+    pthread_mutex_unlock(&registryLock);
+}
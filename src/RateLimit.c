@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <RateLimit.h>
+
+#include <Cytoplasm/Memory.h>
+#include <Cytoplasm/HashMap.h>
+#include <Cytoplasm/Array.h>
+#include <Cytoplasm/Util.h>
+#include <Cytoplasm/Log.h>
+
+#include <pthread.h>
+
+#define RATE_LIMIT_SHARDS 16
+
+typedef struct RateBucket
+{
+    double tokens;
+    uint64_t last;
+
+    /* Kept so that compaction can tell when the bucket is full. */
+    double perMs;
+    double burst;
+} RateBucket;
+
+typedef struct RateLimitShard
+{
+    pthread_mutex_t lock;
+    HashMap *buckets;
+} RateLimitShard;
+
+static RateLimitShard *shards;
+
+static unsigned long
+RateLimitHash(const char *key)
+{
+    unsigned long hash = 2166136261UL;
+
+    while (*key)
+    {
+        hash ^= (unsigned char) *key++;
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
+
+/* Refill a bucket for the time that has passed since it was last
+ * used. */
+static void
+BucketRefill(RateBucket * bucket, uint64_t now)
+{
+    if (now > bucket->last)
+    {
+        bucket->tokens += (now - bucket->last) * bucket->perMs;
+        if (bucket->tokens > bucket->burst)
+        {
+            bucket->tokens = bucket->burst;
+        }
+    }
+    bucket->last = now;
+}
+
+void
+RateLimitInit(void)
+{
+    size_t i;
+
+    if (shards)
+    {
+        return;
+    }
+
+    shards = Malloc(sizeof(RateLimitShard) * RATE_LIMIT_SHARDS);
+    if (!shards)
+    {
+        return;
+    }
+
+    for (i = 0; i < RATE_LIMIT_SHARDS; i++)
+    {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        shards[i].buckets = HashMapCreate();
+    }
+}
+
+void
+RateLimitFree(void)
+{
+    size_t i;
+
+    if (!shards)
+    {
+        return;
+    }
+
+    for (i = 0; i < RATE_LIMIT_SHARDS; i++)
+    {
+        char *key;
+        RateBucket *bucket;
+
+        while (HashMapIterate(shards[i].buckets, &key, (void **) &bucket))
+        {
+            Free(bucket);
+        }
+        HashMapFree(shards[i].buckets);
+        pthread_mutex_destroy(&shards[i].lock);
+    }
+
+    Free(shards);
+    shards = NULL;
+}
+
+uint64_t
+RateLimitTake(char *key, unsigned long perMinute, unsigned long burst)
+{
+    RateLimitShard *shard;
+    RateBucket *bucket;
+    uint64_t now;
+    uint64_t wait = 0;
+
+    if (!shards || !key || !perMinute)
+    {
+        return 0;
+    }
+
+    if (!burst)
+    {
+        burst = 1;
+    }
+
+    shard = &shards[RateLimitHash(key) % RATE_LIMIT_SHARDS];
+    now = UtilTsMillis();
+
+    pthread_mutex_lock(&shard->lock);
+
+    bucket = HashMapGet(shard->buckets, key);
+    if (!bucket)
+    {
+        bucket = Malloc(sizeof(RateBucket));
+        if (!bucket)
+        {
+            /* Better to let the request through than to refuse it
+             * because we're short on memory. */
+            pthread_mutex_unlock(&shard->lock);
+            return 0;
+        }
+
+        bucket->tokens = burst;
+        bucket->last = now;
+        HashMapSet(shard->buckets, key, bucket);
+    }
+
+    /* The configuration may have changed since the bucket was made. */
+    bucket->perMs = perMinute / 60000.0;
+    bucket->burst = burst;
+    BucketRefill(bucket, now);
+
+    if (bucket->tokens >= 1)
+    {
+        bucket->tokens -= 1;
+    }
+    else
+    {
+        wait = (uint64_t) ((1 - bucket->tokens) / bucket->perMs) + 1;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+
+    return wait;
+}
+
+void
+RateLimitCompact(void)
+{
+    uint64_t now = UtilTsMillis();
+    size_t dropped = 0;
+    size_t i;
+
+    if (!shards)
+    {
+        return;
+    }
+
+    for (i = 0; i < RATE_LIMIT_SHARDS; i++)
+    {
+        RateLimitShard *shard = &shards[i];
+        Array *full = ArrayCreate();
+        char *key;
+        RateBucket *bucket;
+        size_t j;
+
+        if (!full)
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&shard->lock);
+
+        /* The map can't be changed while it's being iterated, so
+         * collect the keys first. */
+        while (HashMapIterate(shard->buckets, &key, (void **) &bucket))
+        {
+            BucketRefill(bucket, now);
+            if (bucket->tokens >= bucket->burst)
+            {
+                ArrayAdd(full, key);
+            }
+        }
+
+        for (j = 0; j < ArraySize(full); j++)
+        {
+            Free(HashMapDelete(shard->buckets, ArrayGet(full, j)));
+        }
+        dropped += ArraySize(full);
+
+        pthread_mutex_unlock(&shard->lock);
+        ArrayFree(full);
+    }
+
+    if (dropped)
+    {
+        Log(LOG_DEBUG, "Dropped %lu full rate limit buckets.", (unsigned long) dropped);
+    }
+}
@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <Reaper.h>
+
+#include <Cytoplasm/Memory.h>
+#include <Cytoplasm/Util.h>
+#include <Cytoplasm/Log.h>
+
+#include <pthread.h>
+#include <time.h>
+
+#include <sys/socket.h>
+
+#define REAPER_UNARMED ((size_t) -1)
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static pthread_t thread;
+static int running;
+
+/* A binary min-heap of deadlines, ordered by expiry. */
+static ReaperEntry **heap;
+static size_t size;
+static size_t capacity;
+
+static uint64_t reaped[REAPER_STATES];
+
+static const char *stateNames[REAPER_STATES] = {
+    "body",
+    "send"
+};
+
+static void
+HeapSwap(size_t a, size_t b)
+{
+    ReaperEntry *tmp = heap[a];
+
+    heap[a] = heap[b];
+    heap[b] = tmp;
+    heap[a]->index = a;
+    heap[b]->index = b;
+}
+
+static void
+HeapUp(size_t i)
+{
+    while (i > 0)
+    {
+        size_t parent = (i - 1) / 2;
+
+        if (heap[parent]->deadline <= heap[i]->deadline)
+        {
+            break;
+        }
+
+        HeapSwap(i, parent);
+        i = parent;
+    }
+}
+
+static void
+HeapDown(size_t i)
+{
+    for (;;)
+    {
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        size_t least = i;
+
+        if (left < size && heap[left]->deadline < heap[least]->deadline)
+        {
+            least = left;
+        }
+        if (right < size && heap[right]->deadline < heap[least]->deadline)
+        {
+            least = right;
+        }
+        if (least == i)
+        {
+            break;
+        }
+
+        HeapSwap(i, least);
+        i = least;
+    }
+}
+
+/* Take an entry out of the heap. The lock must be held. */
+static void
+HeapRemove(ReaperEntry * entry)
+{
+    size_t i = entry->index;
+    ReaperEntry *moved;
+
+    entry->index = REAPER_UNARMED;
+
+    size--;
+    if (i == size)
+    {
+        return;
+    }
+
+    moved = heap[size];
+    heap[i] = moved;
+    moved->index = i;
+    HeapUp(i);
+    HeapDown(moved->index);
+}
+
+static void *
+ReaperThread(void *args)
+{
+    (void) args;
+
+    pthread_mutex_lock(&lock);
+    while (running)
+    {
+        uint64_t now = UtilTsMillis();
+
+        while (size && heap[0]->deadline <= now)
+        {
+            ReaperEntry *entry = heap[0];
+
+            HeapRemove(entry);
+
+            /*
+             * The owner of the entry can't get past ReaperDisarm()
+             * until the lock is released, so the file descriptor is
+             * still its connection.
+             */
+            shutdown(entry->fd, SHUT_RDWR);
+            entry->reaped = 1;
+            reaped[entry->state]++;
+        }
+
+        if (size)
+        {
+            struct timespec ts;
+
+            ts.tv_sec = heap[0]->deadline / 1000;
+            ts.tv_nsec = (heap[0]->deadline % 1000) * 1000000;
+            pthread_cond_timedwait(&changed, &lock, &ts);
+        }
+        else
+        {
+            pthread_cond_wait(&changed, &lock);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    return NULL;
+}
+
+int
+ReaperInit(void)
+{
+    pthread_mutex_lock(&lock);
+    if (running)
+    {
+        pthread_mutex_unlock(&lock);
+        return 1;
+    }
+
+    running = 1;
+    if (pthread_create(&thread, NULL, ReaperThread, NULL) != 0)
+    {
+        running = 0;
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&lock);
+
+    return 1;
+}
+
+void
+ReaperFree(void)
+{
+    pthread_mutex_lock(&lock);
+    if (!running)
+    {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    running = 0;
+    pthread_cond_signal(&changed);
+    pthread_mutex_unlock(&lock);
+
+    pthread_join(thread, NULL);
+
+    Free(heap);
+    heap = NULL;
+    size = 0;
+    capacity = 0;
+}
+
+void
+ReaperArm(ReaperEntry * entry, int fd, ReaperState state, long ms)
+{
+    if (!entry)
+    {
+        return;
+    }
+
+    entry->fd = fd;
+    entry->state = state;
+    entry->index = REAPER_UNARMED;
+    entry->reaped = 0;
+
+    if (fd < 0 || ms <= 0)
+    {
+        return;
+    }
+
+    entry->deadline = UtilTsMillis() + (uint64_t) ms;
+
+    pthread_mutex_lock(&lock);
+    if (!running)
+    {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    if (size == capacity)
+    {
+        size_t newCapacity = capacity ? capacity * 2 : 64;
+        ReaperEntry **newHeap = Realloc(heap, newCapacity * sizeof(ReaperEntry *));
+
+        if (!newHeap)
+        {
+            pthread_mutex_unlock(&lock);
+            Log(LOG_WARNING, "Unable to arm a connection deadline.");
+            return;
+        }
+
+        heap = newHeap;
+        capacity = newCapacity;
+    }
+
+    entry->index = size;
+    heap[size] = entry;
+    size++;
+    HeapUp(entry->index);
+
+    /* The timer thread only needs waking if this is now the first
+     * deadline to expire. */
+    if (entry->index == 0)
+    {
+        pthread_cond_signal(&changed);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+int
+ReaperDisarm(ReaperEntry * entry)
+{
+    int ret;
+
+    if (!entry)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&lock);
+    if (entry->index != REAPER_UNARMED)
+    {
+        HeapRemove(entry);
+    }
+    ret = entry->reaped;
+    pthread_mutex_unlock(&lock);
+
+    return ret;
+}
+
+uint64_t
+ReaperCount(ReaperState state)
+{
+    uint64_t count;
+
+    if (state >= REAPER_STATES)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&lock);
+    count = reaped[state];
+    pthread_mutex_unlock(&lock);
+
+    return count;
+}
+
+const char *
+ReaperStateToString(ReaperState state)
+{
+    return state < REAPER_STATES ? stateNames[state] : NULL;
+}
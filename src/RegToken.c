@@ -34,6 +34,7 @@
 #include <Cytoplasm/Log.h>
 
 #include <User.h>
+#include <Trace.h>
 
 int
 RegTokenValid(RegTokenInfo * token)
@@ -118,7 +119,7 @@ RegTokenGetInfo(Db * db, char *token)
         return NULL;
     }
 
-    tokenRef = DbLock(db, 3, "tokens", "registration", token);
+    tokenRef = TraceDbLock(db, 3, "tokens", "registration", token);
     if (!tokenRef)
     {
         return NULL;
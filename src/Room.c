@@ -24,6 +24,7 @@
  */
 
 #include <Room.h>
+#include <Trace.h>
 
 #include <Cytoplasm/Memory.h>
 #include <Cytoplasm/Str.h>
@@ -59,7 +60,7 @@ RoomLock(Db * db, char *id)
         return NULL;
     }
 
-    ref = DbLock(db, 3, "rooms", id, "state");
+    ref = TraceDbLock(db, 3, "rooms", id, "state");
 
     if (!ref)
     {
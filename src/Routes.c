@@ -24,6 +24,8 @@
  */
 #include <Routes.h>
 
+#include <Metrics.h>
+
 HttpRouter *
 RouterBuild(void)
 {
@@ -40,7 +42,8 @@ RouterBuild(void)
         Log(LOG_ERR, "Unable to add route: %s", path); \
         HttpRouterFree(router); \
         return NULL; \
-    }
+    } \
+    MetricsRouteAdd(#func, path)
 
     /* Matrix Specifification Routes */
 
@@ -84,7 +87,7 @@ RouterBuild(void)
 
     /* Telodendria Admin API Routes */
 
-    R("/_telodendria/admin/v1/(restart|shutdown|stats)", RouteProcControl);
+    R("/_telodendria/admin/v1/(restart|shutdown|stats|metrics|traces)", RouteProcControl);
     R("/_telodendria/admin/v1/config", RouteConfig);
     R("/_telodendria/admin/v1/privileges", RoutePrivileges);
     R("/_telodendria/admin/v1/privileges/(.*)", RoutePrivileges);
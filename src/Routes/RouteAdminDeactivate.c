@@ -57,7 +57,7 @@ ROUTE_IMPL(RouteAdminDeactivate, path, argp)
     
     if (method == HTTP_DELETE)
     {
-        request = JsonDecode(HttpServerStream(args->context));
+        request = MatrixRequestJson(args->context);
         if (!request)
         {
             HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -70,7 +70,7 @@ ROUTE_IMPL(RouteAdminTokens, path, argp)
         goto finish;
     }
 
-    user = UserAuthenticate(db, token);
+    user = UserAuthenticateShared(db, token);
     if (!user)
     {
         HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -133,7 +133,7 @@ ROUTE_IMPL(RouteAdminTokens, path, argp)
             RegTokenFree(info);
             break;
         case HTTP_POST:
-            request = JsonDecode(HttpServerStream(args->context));
+            request = MatrixRequestJson(args->context);
             if (!request)
             {
                 HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
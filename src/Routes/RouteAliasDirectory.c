@@ -29,6 +29,7 @@
 #include <Cytoplasm/Json.h>
 #include <Cytoplasm/Str.h>
 
+#include <Alias.h>
 #include <Config.h>
 #include <Parser.h>
 #include <User.h>
@@ -42,25 +43,20 @@ ROUTE_IMPL(RouteAliasDirectory, path, argp)
     HashMap *response;
 
     Db *db = args->matrixArgs->db;
-    DbRef *ref = NULL;
-    HashMap *aliases;
-    HashMap *idObject;
-    JsonValue *val;
-    Array *arr;
 
     char *token;
     char *msg;
     User *user = NULL;
 
     CommonID aliasID;
-    Config config;
+    Config *config = NULL;
 
     aliasID.sigil = '\0';
     aliasID.local = NULL;
     aliasID.server.hostname = NULL;
     aliasID.server.port = NULL;
 
-    ConfigLock(db, &config);
+    config = ConfigAcquire(args->matrixArgs->config);
 
     if (!ParseCommonID(alias, &aliasID) || aliasID.sigil != '#')
     {
@@ -70,28 +66,11 @@ ROUTE_IMPL(RouteAliasDirectory, path, argp)
         goto finish;
     }
 
-    ref = DbLock(db, 1, "aliases");
-    if (!ref && !(ref = DbCreate(db, 1, "aliases")))
-    {
-        msg = "Unable to access alias database.",
-        HttpResponseStatus(args->context, HTTP_INTERNAL_SERVER_ERROR);
-        response = MatrixErrorCreate(M_UNKNOWN, msg);
-        goto finish;
-    }
-
-    aliases = DbJson(ref);
-
     switch (HttpRequestMethodGet(args->context))
     {
         case HTTP_GET:
-            val = JsonGet(aliases, 2, "alias", alias);
-            if (val)
-            {
-                response = HashMapCreate();
-                HashMapSet(response, "room_id", JsonValueDuplicate(HashMapGet(JsonValueAsObject(val), "id")));
-                HashMapSet(response, "servers", JsonValueDuplicate(JsonGet(aliases, 3, "alias", alias, "servers")));
-            }
-            else
+            response = AliasResolve(db, alias);
+            if (!response)
             {
                 msg = "There is no mapped room ID for this room alias.";
                 HttpResponseStatus(args->context, HTTP_NOT_FOUND);
@@ -106,7 +85,7 @@ ROUTE_IMPL(RouteAliasDirectory, path, argp)
                 goto finish;
             }
 
-            user = UserAuthenticate(db, token);
+            user = UserAuthenticateShared(db, token);
             if (!user)
             {
                 HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -116,12 +95,11 @@ ROUTE_IMPL(RouteAliasDirectory, path, argp)
 
             if (HttpRequestMethodGet(args->context) == HTTP_PUT)
             {
-                HashMap *newAlias;
                 char *id;
                 char *serverPart;
 
                 serverPart = ParserRecomposeServerPart(aliasID.server);
-                if (!StrEquals(serverPart, config.serverName))
+                if (!StrEquals(serverPart, config->serverName))
                 {
                     msg = "Invalid server name.";
                     HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -133,14 +111,7 @@ ROUTE_IMPL(RouteAliasDirectory, path, argp)
 
                 Free(serverPart);
 
-                if (JsonGet(aliases, 2, "alias", alias))
-                {
-                    HttpResponseStatus(args->context, HTTP_CONFLICT);
-                    response = MatrixErrorCreate(M_UNKNOWN, "Room alias already exists.");
-                    goto finish;
-                }
-
-                request = JsonDecode(HttpServerStream(args->context));
+                request = MatrixRequestJson(args->context);
                 if (!request)
                 {
                     HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -164,65 +135,43 @@ ROUTE_IMPL(RouteAliasDirectory, path, argp)
                     goto finish;
                 }
 
-                newAlias = HashMapCreate();
-                HashMapSet(newAlias, "createdBy", JsonValueString(UserGetName(user)));
-                HashMapSet(newAlias, "id", JsonValueString(id));
-                HashMapSet(newAlias, "servers", JsonValueArray(ArrayCreate()));
-
-                JsonSet(aliases, JsonValueObject(newAlias), 2, "alias", alias);
-
-                if (!(idObject = JsonValueAsObject(JsonGet(aliases, 2, "id", id))))
+                switch (AliasCreate(db, alias, id, UserGetName(user)))
                 {
-                    arr = ArrayCreate();
-                    idObject = HashMapCreate();
-                    HashMapSet(idObject, "aliases", JsonValueArray(arr));
-                    JsonSet(aliases, JsonValueObject(idObject), 2, "id", id);
+                    case ALIAS_OK:
+                        break;
+                    case ALIAS_EXISTS:
+                        HttpResponseStatus(args->context, HTTP_CONFLICT);
+                        response = MatrixErrorCreate(M_UNKNOWN, "Room alias already exists.");
+                        goto finish;
+                    default:
+                        msg = "Unable to access alias database.";
+                        HttpResponseStatus(args->context, HTTP_INTERNAL_SERVER_ERROR);
+                        response = MatrixErrorCreate(M_UNKNOWN, msg);
+                        goto finish;
                 }
-                val = HashMapGet(idObject, "aliases");
-                arr = JsonValueAsArray(val);
-                ArrayAdd(arr, JsonValueString(alias));
-
             }
             else
             {
-                HashMap *roomAlias;
-                char *id;
-
-                if (!(val = JsonGet(aliases, 2, "alias", alias)))
-                {
-                    HttpResponseStatus(args->context, HTTP_NOT_FOUND);
-                    response = MatrixErrorCreate(M_NOT_FOUND, "Room alias not found.");
-                    goto finish;
-                }
-                roomAlias = JsonValueAsObject(val);
-                id = StrDuplicate(JsonValueAsString(HashMapGet(roomAlias, "id")));
-
-                if (!(UserGetPrivileges(user) & USER_ALIAS) && !StrEquals(UserGetName(user), JsonValueAsString(JsonGet(roomAlias, 1, "createdBy"))))
-                {
-                    HttpResponseStatus(args->context, HTTP_UNAUTHORIZED);
-                    response = MatrixErrorCreate(M_UNAUTHORIZED, NULL);
-                    Free(id);
-                    goto finish;
-                }
-
-                JsonValueFree(HashMapDelete(JsonValueAsObject(HashMapGet(aliases, "alias")), alias));
+                int privileged = !!(UserGetPrivileges(user) & USER_ALIAS);
 
-                idObject = JsonValueAsObject(JsonGet(aliases, 2, "id", id));
-                if (idObject)
+                switch (AliasDelete(db, alias, UserGetName(user), privileged))
                 {
-                    size_t i;
-                    val = HashMapGet(idObject, "aliases");
-                    arr = JsonValueAsArray(val);
-                    for (i = 0; i < ArraySize(arr); i++)
-                    {
-                        if (StrEquals(JsonValueAsString(ArrayGet(arr, i)), alias))
-                        {
-                            JsonValueFree(ArrayDelete(arr, i));
-                            break;
-                        }
-                    }
+                    case ALIAS_OK:
+                        break;
+                    case ALIAS_NOT_FOUND:
+                        HttpResponseStatus(args->context, HTTP_NOT_FOUND);
+                        response = MatrixErrorCreate(M_NOT_FOUND, "Room alias not found.");
+                        goto finish;
+                    case ALIAS_FORBIDDEN:
+                        HttpResponseStatus(args->context, HTTP_UNAUTHORIZED);
+                        response = MatrixErrorCreate(M_UNAUTHORIZED, NULL);
+                        goto finish;
+                    default:
+                        msg = "Unable to access alias database.";
+                        HttpResponseStatus(args->context, HTTP_INTERNAL_SERVER_ERROR);
+                        response = MatrixErrorCreate(M_UNKNOWN, msg);
+                        goto finish;
                 }
-                Free(id);
             }
             response = HashMapCreate();
 
@@ -235,9 +184,8 @@ ROUTE_IMPL(RouteAliasDirectory, path, argp)
 
 finish:
     CommonIDFree(aliasID);
-    ConfigUnlock(&config);
+    ConfigRelease(args->matrixArgs->config, config);
     UserUnlock(user);
-    DbUnlock(db, ref);
     JsonFree(request);
     return response;
 }
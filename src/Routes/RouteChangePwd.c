@@ -68,14 +68,13 @@ ROUTE_IMPL(RouteChangePwd, path, argp)
 
     char *msg;
 
-    Config config;
+    Config *config = NULL;
 
-    ConfigLock(db, &config);
-    if (!config.ok)
+    config = ConfigAcquire(args->matrixArgs->config);
+    if (!config)
     {
-        Log(LOG_ERR, "%s", config.err);
         HttpResponseStatus(args->context, HTTP_INTERNAL_SERVER_ERROR);
-        return MatrixErrorCreate(M_UNKNOWN, config.err);
+        return MatrixErrorCreate(M_UNKNOWN, NULL);
     }
 
     (void) path;
@@ -94,7 +93,7 @@ ROUTE_IMPL(RouteChangePwd, path, argp)
         goto finish;
     }
 
-    request = JsonDecode(HttpServerStream(args->context));
+    request = MatrixRequestJson(args->context);
     if (!request)
     {
         HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -158,7 +157,7 @@ ROUTE_IMPL(RouteChangePwd, path, argp)
     response = HashMapCreate();
 
 finish:
-    ConfigUnlock(&config);
+    ConfigRelease(args->matrixArgs->config, config);
     UserUnlock(user);
     JsonFree(request);
     return response;
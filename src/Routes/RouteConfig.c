@@ -51,7 +51,7 @@ ROUTE_IMPL(RouteConfig, path, argp)
         goto finish;
     }
 
-    user = UserAuthenticate(args->matrixArgs->db, token);
+    user = UserAuthenticateShared(args->matrixArgs->db, token);
     if (!user)
     {
         HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -82,7 +82,7 @@ ROUTE_IMPL(RouteConfig, path, argp)
             response = JsonDuplicate(DbJson(config.ref));
             break;
         case HTTP_POST:
-            request = JsonDecode(HttpServerStream(args->context));
+            request = MatrixRequestJson(args->context);
             if (!request)
             {
                 HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -95,6 +95,8 @@ ROUTE_IMPL(RouteConfig, path, argp)
             {
                 if (DbJsonSet(config.ref, request))
                 {
+                    ConfigStoreUpdate(args->matrixArgs->config, request);
+
                     response = HashMapCreate();
                     /*
                      * TODO: Apply configuration and set this only if a main
@@ -119,7 +121,7 @@ ROUTE_IMPL(RouteConfig, path, argp)
             JsonFree(request);
             break;
         case HTTP_PUT:
-            request = JsonDecode(HttpServerStream(args->context));
+            request = MatrixRequestJson(args->context);
             if (!request)
             {
                 HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -136,6 +138,8 @@ ROUTE_IMPL(RouteConfig, path, argp)
             {
                 if (DbJsonSet(config.ref, newJson))
                 {
+                    ConfigStoreUpdate(args->matrixArgs->config, newJson);
+
                     response = HashMapCreate();
                     /*
                      * TODO: Apply configuration and set this only if a main
@@ -48,7 +48,7 @@ ROUTE_IMPL(RouteCreateRoom, path, argp)
         goto finish;
     }
 
-    request = JsonDecode(HttpServerStream(args->context));
+    request = MatrixRequestJson(args->context);
     if (!request)
     {
         HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
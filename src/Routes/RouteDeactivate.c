@@ -46,19 +46,18 @@ ROUTE_IMPL(RouteDeactivate, path, argp)
 
     Db *db = args->matrixArgs->db;
     User *user = NULL;
-    Config config;
+    Config *config = NULL;
 
 
     char *msg;
 
     (void) path;
 
-    ConfigLock(db, &config);
-    if (!config.ok)
+    config = ConfigAcquire(args->matrixArgs->config);
+    if (!config)
     {
-        Log(LOG_ERR, "%s", config.err);
         HttpResponseStatus(args->context, HTTP_INTERNAL_SERVER_ERROR);
-        response = MatrixErrorCreate(M_UNKNOWN, config.err);
+        response = MatrixErrorCreate(M_UNKNOWN, NULL);
         goto finish;
     }
 
@@ -70,7 +69,7 @@ ROUTE_IMPL(RouteDeactivate, path, argp)
         goto finish;
     }
 
-    request = JsonDecode(HttpServerStream(args->context));
+    request = MatrixRequestJson(args->context);
     if (!request)
     {
         HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -118,11 +117,10 @@ ROUTE_IMPL(RouteDeactivate, path, argp)
     {
         /* No access token, we have to get the user off UIA */
         char *session = JsonValueAsString(JsonGet(request, 2, "auth", "session"));
-        DbRef *sessionRef = DbLock(db, 2, "user_interactive", session);
-        char *userId = JsonValueAsString(HashMapGet(DbJson(sessionRef), "user"));
+        char *userId = UiaSessionGet(session, "user");
 
         user = UserLock(db, userId);
-        DbUnlock(db, sessionRef);
+        Free(userId);
     }
 
     if (!user)
@@ -151,6 +149,6 @@ ROUTE_IMPL(RouteDeactivate, path, argp)
 finish:
     JsonFree(request);
     UserUnlock(user);
-    ConfigUnlock(&config);
+    ConfigRelease(args->matrixArgs->config, config);
     return response;
 }
@@ -31,26 +31,25 @@
 #include <Cytoplasm/Str.h>
 
 #include <User.h>
+#include <Trace.h>
 #include <string.h>
 
 #include <Schema/Filter.h>
 
 static char *
-GetServerName(Db * db)
+GetServerName(ConfigStore * store)
 {
     char *name;
 
-    Config config;
-
-    ConfigLock(db, &config);
-    if (!config.ok)
+    Config *config = ConfigAcquire(store);
+    if (!config)
     {
         return NULL;
     }
 
-    name = StrDuplicate(config.serverName);
+    name = StrDuplicate(config->serverName);
 
-    ConfigUnlock(&config);
+    ConfigRelease(store, config);
 
     return name;
 }
@@ -80,7 +79,7 @@ ROUTE_IMPL(RouteFilter, path, argp)
         return MatrixErrorCreate(M_UNKNOWN, NULL);
     }
 
-    serverName = GetServerName(db);
+    serverName = GetServerName(args->matrixArgs->config);
     if (!serverName)
     {
         HttpResponseStatus(args->context, HTTP_INTERNAL_SERVER_ERROR);
@@ -111,7 +110,7 @@ ROUTE_IMPL(RouteFilter, path, argp)
         goto finish;
     }
 
-    user = UserAuthenticate(db, token);
+    user = UserAuthenticateShared(db, token);
     if (!user)
     {
         HttpResponseStatus(args->context, HTTP_UNAUTHORIZED);
@@ -129,7 +128,7 @@ ROUTE_IMPL(RouteFilter, path, argp)
 
     if (ArraySize(path) == 2 && HttpRequestMethodGet(args->context) == HTTP_GET)
     {
-        DbRef *ref = DbLock(db, 3, "filters", UserGetName(user), ArrayGet(path, 1));
+        DbRef *ref = TraceDbLock(db, 3, "filters", UserGetName(user), ArrayGet(path, 1));
 
         if (!ref)
         {
@@ -151,7 +150,7 @@ ROUTE_IMPL(RouteFilter, path, argp)
         char *parseErr;
         HashMap *filterJson;
 
-        request = JsonDecode(HttpServerStream(args->context));
+        request = MatrixRequestJson(args->context);
         if (!request)
         {
             HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
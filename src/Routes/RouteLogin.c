@@ -65,14 +65,13 @@ ROUTE_IMPL(RouteLogin, path, argp)
 
     char *msg;
 
-    Config config;
+    Config *config = NULL;
 
-    ConfigLock(db, &config);
-    if (!config.ok)
+    config = ConfigAcquire(args->matrixArgs->config);
+    if (!config)
     {
-        Log(LOG_ERR, "%s", config.err);
         HttpResponseStatus(args->context, HTTP_INTERNAL_SERVER_ERROR);
-        return MatrixErrorCreate(M_UNKNOWN, config.err);
+        return MatrixErrorCreate(M_UNKNOWN, NULL);
     }
 
     (void) path;
@@ -92,7 +91,7 @@ ROUTE_IMPL(RouteLogin, path, argp)
             HashMapSet(response, "flows", JsonValueArray(enabledFlows));
             break;
         case HTTP_POST:
-            request = JsonDecode(HttpServerStream(args->context));
+            request = MatrixRequestJson(args->context);
             if (!request)
             {
                 HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -151,7 +150,7 @@ ROUTE_IMPL(RouteLogin, path, argp)
             }
 
 
-            userId = UserIdParse(userIdentifier.user, config.serverName);
+            userId = UserIdParse(userIdentifier.user, config->serverName);
             if (!userId)
             {
                 msg = "Invalid user ID.";
@@ -160,7 +159,7 @@ ROUTE_IMPL(RouteLogin, path, argp)
                 break;
             }
 
-            if (!ParserServerNameEquals(userId->server, config.serverName)
+            if (!ParserServerNameEquals(userId->server, config->serverName)
                 || !UserExists(db, userId->local))
             {
                 msg = "Unknown user ID.";
@@ -222,14 +221,13 @@ ROUTE_IMPL(RouteLogin, path, argp)
                            JsonValueString(loginInfo->refreshToken));
             }
 
-            fullUsername = StrConcat(4, "@", UserGetName(user), ":",
-                                     config.serverName);
+            fullUsername = ArenaStrConcat(args->arena, 4, "@", UserGetName(user), ":",
+                                          config->serverName);
             HashMapSet(response, "user_id", JsonValueString(fullUsername));
-            Free(fullUsername);
 
             HashMapSet(response, "well_known",
                        JsonValueObject(
-                                       MatrixClientWellKnown(config.baseUrl, config.identityServer)));
+                                       MatrixClientWellKnown(config->baseUrl, config->identityServer)));
 
             UserAccessTokenFree(loginInfo->accessToken);
             Free(loginInfo->refreshToken);
@@ -247,7 +245,7 @@ ROUTE_IMPL(RouteLogin, path, argp)
 
     UserIdFree(userId);
     JsonFree(request);
-    ConfigUnlock(&config);
+    ConfigRelease(args->matrixArgs->config, config);
 
     LoginRequestFree(&loginRequest);
     LoginRequestUserIdentifierFree(&userIdentifier);
@@ -84,7 +84,7 @@ ROUTE_IMPL(RoutePrivileges, path, argp)
         case HTTP_POST:
         case HTTP_PUT:
         case HTTP_DELETE:
-            request = JsonDecode(HttpServerStream(args->context));
+            request = MatrixRequestJson(args->context);
             if (!request)
             {
                 HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -25,6 +25,9 @@
 #include <Routes.h>
 
 #include <User.h>
+#include <TokenCache.h>
+#include <Metrics.h>
+#include <Trace.h>
 #include <Cytoplasm/Memory.h>
 #include <Cytoplasm/Str.h>
 
@@ -46,7 +49,7 @@ ROUTE_IMPL(RouteProcControl, path, argp)
         goto finish;
     }
 
-    user = UserAuthenticate(args->matrixArgs->db, token);
+    user = UserAuthenticateShared(args->matrixArgs->db, token);
     if (!user)
     {
         HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -90,9 +93,27 @@ ROUTE_IMPL(RouteProcControl, path, argp)
 
                 HashMapSet(response, "version", JsonValueString(TELODENDRIA_VERSION));
                 HashMapSet(response, "memory_allocated", JsonValueInteger(allocated));
+                HashMapSet(response, "token_cache", JsonValueObject(TokenCacheStats()));
 
                 goto finish;
             }
+            else if (StrEquals(op, "traces"))
+            {
+                response = HashMapCreate();
+                HashMapSet(response, "traces", JsonValueArray(TraceList()));
+                goto finish;
+            }
+            else if (StrEquals(op, "metrics"))
+            {
+                HttpResponseHeader(args->context, "Content-Type",
+                                   "text/plain; version=0.0.4");
+                MetricsWrite(args->body);
+
+                /* The body has been written, so there's no JSON
+                 * response. */
+                response = NULL;
+                goto finish;
+            }
             else
             {
                 HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
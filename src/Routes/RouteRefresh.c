@@ -32,6 +32,7 @@
 #include <Cytoplasm/Str.h>
 
 #include <User.h>
+#include <Trace.h>
 
 ROUTE_IMPL(RouteRefresh, path, argp)
 {
@@ -44,7 +45,8 @@ ROUTE_IMPL(RouteRefresh, path, argp)
 
     char *oldAccessToken;
     UserAccessToken *newAccessToken;
-    char *deviceId;
+    char *userName = NULL;
+    char *deviceId = NULL;
 
     char *msg;
 
@@ -52,7 +54,6 @@ ROUTE_IMPL(RouteRefresh, path, argp)
 
     User *user = NULL;
     DbRef *rtRef = NULL;
-    DbRef *oAtRef = NULL;
 
     (void) path;
 
@@ -63,7 +64,7 @@ ROUTE_IMPL(RouteRefresh, path, argp)
         return MatrixErrorCreate(M_UNRECOGNIZED, msg);
     }
 
-    request = JsonDecode(HttpServerStream(args->context));
+    request = MatrixRequestJson(args->context);
     if (!request)
     {
         HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -82,7 +83,7 @@ ROUTE_IMPL(RouteRefresh, path, argp)
     refreshToken = JsonValueAsString(val);
 
     /* Get the refresh token object */
-    rtRef = DbLock(db, 3, "tokens", "refresh", refreshToken);
+    rtRef = TraceDbLock(db, 3, "tokens", "refresh", refreshToken);
 
     if (!rtRef)
     {
@@ -93,9 +94,8 @@ ROUTE_IMPL(RouteRefresh, path, argp)
 
     /* Get the access token and device the refresh token refreshes */
     oldAccessToken = JsonValueAsString(HashMapGet(DbJson(rtRef), "refreshes"));
-    oAtRef = DbLock(db, 3, "tokens", "access", oldAccessToken);
 
-    if (!oAtRef)
+    if (!UserAccessTokenInfo(db, oldAccessToken, &userName, &deviceId))
     {
         Log(LOG_ERR, "Refresh token '%s' points to an access token that doesn't exist.",
             refreshToken);
@@ -112,7 +112,7 @@ ROUTE_IMPL(RouteRefresh, path, argp)
     }
 
     /* Get the user associated with the access token and device */
-    user = UserLock(db, JsonValueAsString(HashMapGet(DbJson(oAtRef), "user")));
+    user = UserLock(db, userName);
     if (!user)
     {
         Log(LOG_ERR, "Access token '%s' points to a user that doesn't exist.",
@@ -124,17 +124,14 @@ ROUTE_IMPL(RouteRefresh, path, argp)
         DbUnlock(db, rtRef);
         DbDelete(db, 3, "tokens", "refresh", refreshToken);
 
-        DbUnlock(db, oAtRef);
-        DbDelete(db, 3, "tokens", "access", oldAccessToken);
+        UserAccessTokenDelete(db, oldAccessToken);
 
         rtRef = NULL;
-        oAtRef = NULL;
 
         goto finish;
     }
 
     /* Generate a new access token associated with the device and user. */
-    deviceId = JsonValueAsString(HashMapGet(DbJson(oAtRef), "device"));
     newAccessToken = UserAccessTokenGenerate(user, deviceId, 1);
     UserAccessTokenSave(db, newAccessToken);
 
@@ -142,8 +139,7 @@ ROUTE_IMPL(RouteRefresh, path, argp)
     JsonValueFree(JsonSet(UserGetDevices(user), JsonValueString(newAccessToken->string), 2, deviceId, "accessToken"));
 
     /* Delete old access token */
-    DbUnlock(db, oAtRef);
-    DbDelete(db, 3, "tokens", "access", oldAccessToken);
+    UserAccessTokenDelete(db, oldAccessToken);
 
     /* Update the refresh token to point to the new access token */
     JsonValueFree(HashMapSet(DbJson(rtRef), "refreshes", JsonValueString(newAccessToken->string)));
@@ -158,6 +154,8 @@ ROUTE_IMPL(RouteRefresh, path, argp)
 
 finish:
     JsonFree(request);
+    Free(userName);
+    Free(deviceId);
     DbUnlock(db, rtRef);
     UserUnlock(user);
     return response;
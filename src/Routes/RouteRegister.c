@@ -71,9 +71,9 @@ ROUTE_IMPL(RouteRegister, path, argp)
     int uiaResult;
 
     char *session;
-    DbRef *sessionRef;
+    char *token;
 
-    Config config;
+    Config *config = NULL;
 
     regReq.username = NULL;
     regReq.password = NULL;
@@ -82,12 +82,11 @@ ROUTE_IMPL(RouteRegister, path, argp)
     regReq.refresh_token = 0;
     regReq.inhibit_login = 0;
 
-    ConfigLock(db, &config);
-    if (!config.ok)
+    config = ConfigAcquire(args->matrixArgs->config);
+    if (!config)
     {
-        Log(LOG_ERR, "%s", config.err);
         HttpResponseStatus(args->context, HTTP_INTERNAL_SERVER_ERROR);
-        return MatrixErrorCreate(M_UNKNOWN, config.err);
+        return MatrixErrorCreate(M_UNKNOWN, NULL);
     }
 
     if (ArraySize(path) == 0)
@@ -99,7 +98,7 @@ ROUTE_IMPL(RouteRegister, path, argp)
             goto end;
         }
 
-        request = JsonDecode(HttpServerStream(args->context));
+        request = MatrixRequestJson(args->context);
         if (!request)
         {
             HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -115,7 +114,7 @@ ROUTE_IMPL(RouteRegister, path, argp)
 
         if (regReq.username)
         {
-            if (!UserValidate(regReq.username, config.serverName))
+            if (!UserValidate(regReq.username, config->serverName))
             {
                 HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
                 response = MatrixErrorCreate(M_INVALID_USERNAME, NULL);
@@ -133,7 +132,7 @@ ROUTE_IMPL(RouteRegister, path, argp)
         uiaFlows = ArrayCreate();
         ArrayAdd(uiaFlows, RouteRegisterRegFlow());
 
-        if (config.registration)
+        if (config->registration)
         {
             ArrayAdd(uiaFlows, UiaDummyFlow());
         }
@@ -179,10 +178,9 @@ ROUTE_IMPL(RouteRegister, path, argp)
         user = UserCreate(db, regReq.username, regReq.password);
         response = HashMapCreate();
 
-        fullUsername = StrConcat(4, 
-            "@", UserGetName(user), ":", config.serverName);
+        fullUsername = ArenaStrConcat(args->arena, 4,
+            "@", UserGetName(user), ":", config->serverName);
         HashMapSet(response, "user_id", JsonValueString(fullUsername));
-        Free(fullUsername);
 
         HttpResponseStatus(args->context, HTTP_OK);
         if (!regReq.inhibit_login)
@@ -210,29 +208,20 @@ ROUTE_IMPL(RouteRegister, path, argp)
         }
 
         session = JsonValueAsString(JsonGet(request, 2, "auth", "session"));
-        sessionRef = DbLock(db, 2, "user_interactive", session);
-        if (sessionRef)
+        token = UiaSessionGet(session, "registration_token");
+
+        /* Grant the privileges specified by the given token */
+        if (token)
         {
-            char *token = JsonValueAsString(HashMapGet(DbJson(sessionRef), "registration_token"));
+            RegTokenInfo *info = RegTokenGetInfo(db, token);
 
-            /* Grant the privileges specified by the given token */
-            if (token)
+            if (info)
             {
-                RegTokenInfo *info = RegTokenGetInfo(db, token);
-
-                if (info)
-                {
-                    UserSetPrivileges(user, UserDecodePrivileges(info->grants));
-                    RegTokenClose(info);
-                    RegTokenFree(info);
-                }
+                UserSetPrivileges(user, UserDecodePrivileges(info->grants));
+                RegTokenClose(info);
+                RegTokenFree(info);
             }
-            DbUnlock(db, sessionRef);
-        }
-        else
-        {
-            Log(LOG_WARNING, "Unable to lock UIA session reference to check");
-            Log(LOG_WARNING, "privileges for user registration.");
+            Free(token);
         }
 
         Log(LOG_INFO, "Registered user '%s'", UserGetName(user));
@@ -257,7 +246,7 @@ finish:
                 HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
                 response = MatrixErrorCreate(M_MISSING_PARAM, msg);
             }
-            else if (!UserValidate(username, config.serverName))
+            else if (!UserValidate(username, config->serverName))
             {
                 HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
                 response = MatrixErrorCreate(M_INVALID_USERNAME, NULL);
@@ -281,6 +270,6 @@ finish:
     }
 
 end:
-    ConfigUnlock(&config);
+    ConfigRelease(args->matrixArgs->config, config);
     return response;
 }
@@ -58,7 +58,7 @@ ROUTE_IMPL(RouteRequestToken, path, argp)
         return MatrixErrorCreate(M_UNRECOGNIZED, msg);
     }
 
-    request = JsonDecode(HttpServerStream(args->context));
+    request = MatrixRequestJson(args->context);
     if (!request)
     {
         HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -29,6 +29,7 @@
 #include <Cytoplasm/Json.h>
 #include <Cytoplasm/Db.h>
 
+#include <Alias.h>
 #include <Matrix.h>
 #include <User.h>
 
@@ -40,13 +41,10 @@ ROUTE_IMPL(RouteRoomAliases, path, argp)
     char *msg;
 
     HashMap *response = NULL;
-    HashMap *aliases = NULL;
-    HashMap *reversealias = NULL;
 
-    JsonValue *val;
+    JsonValue *aliases;
 
     Db *db = args->matrixArgs->db;
-    DbRef *ref = NULL;
 
     User *user = NULL;
 
@@ -63,7 +61,7 @@ ROUTE_IMPL(RouteRoomAliases, path, argp)
     {
         goto finish;
     }
-    user = UserAuthenticate(db, token);
+    user = UserAuthenticateShared(db, token);
     if (!user)
     {
         HttpResponseStatus(args->context, HTTP_UNAUTHORIZED);
@@ -82,10 +80,8 @@ ROUTE_IMPL(RouteRoomAliases, path, argp)
         goto finish;
     }
 
-    ref = DbLock(db, 1, "aliases");
-    aliases = DbJson(ref);
-    reversealias = JsonValueAsObject(JsonGet(aliases, 2, "id", roomId));
-    if (!reversealias)
+    aliases = AliasList(db, roomId);
+    if (!aliases)
     {
         /* We do not know about the room ID. */
         msg = "Unknown room ID.";
@@ -95,10 +91,8 @@ ROUTE_IMPL(RouteRoomAliases, path, argp)
     }
 
     response = HashMapCreate();
-    val = JsonGet(reversealias, 1, "aliases");
-    HashMapSet(response, "aliases", JsonValueDuplicate(val));
+    HashMapSet(response, "aliases", aliases);
 finish:
-    DbUnlock(db, ref);
     UserUnlock(user);
     return response;
 }
@@ -28,12 +28,11 @@
 ROUTE_IMPL(RouteStaticDefault, path, argp)
 {
     RouteArgs *args = argp;
-    Stream *stream = HttpServerStream(args->context);
+    Stream *stream = args->body;
 
     (void) path;
 
     HttpResponseHeader(args->context, "Content-Type", "text/html");
-    HttpSendHeaders(args->context);
     HtmlBegin(stream, "It works! Telodendria is running.");
 
     StreamPuts(stream,
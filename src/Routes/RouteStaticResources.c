@@ -29,7 +29,7 @@
 ROUTE_IMPL(RouteStaticResources, path, argp)
 {
     RouteArgs *args = argp;
-    Stream *stream = HttpServerStream(args->context);
+    Stream *stream = args->body;
     char *res = ArrayGet(path, 0);
 
     if (!res)
@@ -42,7 +42,6 @@ ROUTE_IMPL(RouteStaticResources, path, argp)
     if (StrEquals(res, "js"))
     {
         HttpResponseHeader(args->context, "Content-Type", "text/javascript");
-        HttpSendHeaders(args->context);
 
         StreamPuts(stream,
                    "function findGetParameter(parameterName) {"
@@ -92,7 +91,6 @@ ROUTE_IMPL(RouteStaticResources, path, argp)
     else if (StrEquals(res, "css"))
     {
         HttpResponseHeader(args->context, "Content-Type", "text/css");
-        HttpSendHeaders(args->context);
         StreamPuts(stream,
                    ":root {"
                    "  color-scheme: dark;"
@@ -53,7 +53,7 @@ ROUTE_IMPL(RouteTokenValid, path, argp)
         return MatrixErrorCreate(M_UNRECOGNIZED, msg);
     }
 
-    request = JsonDecode(HttpServerStream(args->context));
+    request = MatrixRequestJson(args->context);
     if (!request)
     {
         HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -32,7 +32,7 @@
 ROUTE_IMPL(RouteUiaFallback, path, argp)
 {
     RouteArgs *args = argp;
-    Stream *stream = HttpServerStream(args->context);
+    Stream *stream = args->body;
     HashMap *requestParams = HttpRequestParams(args->context);
     char *authType = ArrayGet(path, 0);
     char *sessionId;
@@ -52,22 +52,21 @@ ROUTE_IMPL(RouteUiaFallback, path, argp)
         HashMap *request;
         HashMap *response;
         int uiaResult;
-        Config config;
+        Config *config = NULL;
         Array *flows;
         Array *flow;
 
-        ConfigLock(args->matrixArgs->db, &config);
-        if (!config.ok)
+        config = ConfigAcquire(args->matrixArgs->config);
+        if (!config)
         {
-            Log(LOG_ERR, "%s", config.err);
             HttpResponseStatus(args->context, HTTP_INTERNAL_SERVER_ERROR);
-            return MatrixErrorCreate(M_UNKNOWN, config.err);
+            return MatrixErrorCreate(M_UNKNOWN, NULL);
         }
 
-        request = JsonDecode(HttpServerStream(args->context));
+        request = MatrixRequestJson(args->context);
         if (!request)
         {
-            ConfigUnlock(&config);
+            ConfigRelease(args->matrixArgs->config, config);
             HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
             return MatrixErrorCreate(M_NOT_JSON, NULL);
         }
@@ -91,7 +90,7 @@ ROUTE_IMPL(RouteUiaFallback, path, argp)
         }
 
         JsonFree(request);
-        ConfigUnlock(&config);
+        ConfigRelease(args->matrixArgs->config, config);
         return response;
     }
     else if (HttpRequestMethodGet(args->context) != HTTP_GET)
@@ -110,7 +109,6 @@ ROUTE_IMPL(RouteUiaFallback, path, argp)
     }
 
     HttpResponseHeader(args->context, "Content-Type", "text/html");
-    HttpSendHeaders(args->context);
     HtmlBegin(stream, "Authentication");
 
     if (StrEquals(authType, "m.login.password"))
@@ -34,6 +34,31 @@
 #include <Schema/UserDirectoryRequest.h>
 
 #include <User.h>
+#include <UserIndex.h>
+
+#include <string.h>
+
+static HashMap *
+DirectoryEntry(Arena * arena, char *name, char *displayName, char *avatarUrl,
+               char *serverName)
+{
+    HashMap *obj = HashMapCreate();
+    char *uID;
+
+    if (displayName)
+    {
+        JsonSet(obj, JsonValueString(displayName), 1, "display_name");
+    }
+    if (avatarUrl)
+    {
+        JsonSet(obj, JsonValueString(avatarUrl), 1, "avatar_url");
+    }
+
+    uID = ArenaStrConcat(arena, 4, "@", name, ":", serverName);
+    JsonSet(obj, JsonValueString(uID), 1, "user_id");
+
+    return obj;
+}
 
 ROUTE_IMPL(RouteUserDirectory, path, argp)
 {
@@ -46,7 +71,7 @@ ROUTE_IMPL(RouteUserDirectory, path, argp)
 
     Db *db = args->matrixArgs->db;
 
-    Config config = { .ok = 0 };
+    Config *config = NULL;
 
     User *user = NULL;
 
@@ -56,7 +81,10 @@ ROUTE_IMPL(RouteUserDirectory, path, argp)
 
     UserDirectoryRequest dirRequest;
 
-    size_t i, included;
+    Array *found;
+    char *searchTerm = NULL;
+    size_t i, included, limit;
+    int limited;
 
     (void) path;
 
@@ -72,7 +100,7 @@ ROUTE_IMPL(RouteUserDirectory, path, argp)
         goto finish;
     }
 
-    request = JsonDecode(HttpServerStream(args->context));
+    request = MatrixRequestJson(args->context);
     if (!request)
     {
         HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -101,7 +129,7 @@ ROUTE_IMPL(RouteUserDirectory, path, argp)
     }
 
     /* TODO: Actually use information related to the user. */
-    user = UserAuthenticate(db, token);
+    user = UserAuthenticateShared(db, token);
     if (!user)
     {
         HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -110,37 +138,59 @@ ROUTE_IMPL(RouteUserDirectory, path, argp)
     }
     requesterName = UserGetName(user);
 
+    config = ConfigAcquire(args->matrixArgs->config);
+    if (!config)
+    {
+        Log(LOG_ERR, "Directory endpoint failed to get configuration.");
+        HttpResponseStatus(args->context, HTTP_INTERNAL_SERVER_ERROR);
+        response = MatrixErrorCreate(M_UNKNOWN, NULL);
+
+        goto finish;
+    }
+
     response = HashMapCreate();
     results = ArrayCreate();
 
-    /* TODO: Check for users matching search term and users outside our 
-     * local server. */
-    users = DbList(db, 1, "users");
+    limit = dirRequest.limit > 0 ? (size_t) dirRequest.limit : 0;
+    if (limit > USER_INDEX_MAX_LIMIT)
+    {
+        limit = USER_INDEX_MAX_LIMIT;
+    }
 
-    ConfigLock(db, &config);
-    if (!config.ok)
+    /* TODO: Check for users outside our local server. */
+    found = UserIndexSearch(dirRequest.search_term, limit, &limited);
+    if (found)
     {
-        Log(LOG_ERR, "Directory endpoint failed to lock configuration.");
-        HttpResponseStatus(args->context, HTTP_INTERNAL_SERVER_ERROR);
-        response = MatrixErrorCreate(M_UNKNOWN, config.err);
+        for (i = 0; i < ArraySize(found); i++)
+        {
+            UserIndexResult *result = ArrayGet(found, i);
 
-        goto finish;
+            ArrayAdd(results, JsonValueObject(DirectoryEntry(args->arena, result->name,
+                     result->displayName, result->avatarUrl,
+                     config->serverName)));
+        }
+
+        UserIndexResultsFree(found);
+        goto respond;
     }
 
-#define IncludedLtLimit ((int64_t) included < dirRequest.limit)
-    for (i = 0, included = 0; i < ArraySize(users) && IncludedLtLimit; i++)
-#undef IncludedLtLimit
+    /* The index is still being built, or couldn't be searched, so scan
+     * the users directly. */
+    searchTerm = ArenaStrLower(args->arena, dirRequest.search_term);
+    users = DbList(db, 1, "users");
+
+    for (i = 0, included = 0; i < ArraySize(users) && included < limit; i++)
     {
-        HashMap *obj;
         User *currentUser;
         char *name = ArrayGet(users, i);
         char *displayName;
+        char *lowerName;
         char *lowerDisplayName;
         char *avatarUrl;
 
         if (!StrEquals(name, requesterName))
         {
-            currentUser = UserLock(db, name);
+            currentUser = UserLockShared(db, name);
         }
         else
         {
@@ -148,53 +198,42 @@ ROUTE_IMPL(RouteUserDirectory, path, argp)
         }
 
         displayName = UserGetProfile(currentUser, "displayname");
-        lowerDisplayName = StrLower(displayName);
+        /* These are freed every time around, so that the scan doesn't
+         * keep a copy of every user's names in the request arena. */
+        lowerName = StrLower(name);
+        lowerDisplayName = displayName ? StrLower(displayName) : NULL;
         avatarUrl = UserGetProfile(currentUser, "avatar_url");
 
-        /* Check for the user ID and display name. */
-        if (strstr(name, dirRequest.search_term) ||
-            (lowerDisplayName && 
-             strstr(lowerDisplayName, dirRequest.search_term)))
+        /* Check for the user ID and display name. Deactivated users
+         * are left out, as they are from the index. */
+        if (!UserDeactivated(currentUser) &&
+            ((lowerName && strstr(lowerName, searchTerm)) ||
+             (lowerDisplayName &&
+              strstr(lowerDisplayName, searchTerm))))
         {
             included++;
 
-            obj = HashMapCreate();
-            if (displayName)
-            {
-                JsonSet(obj, JsonValueString(displayName), 1, "display_name");
-            }
-            if (avatarUrl)
-            {
-                JsonSet(obj, JsonValueString(displayName), 1, "avatar_url");
-            }
-            if (name)
-            {
-                char *uID = StrConcat(4, "@", name, ":", config.serverName);
-                JsonSet(obj, JsonValueString(uID), 1, "user_id");
-                Free(uID);
-            }
-            ArrayAdd(results, JsonValueObject(obj));
-        }
-        if (lowerDisplayName)
-        {
-            Free(lowerDisplayName);
+            ArrayAdd(results, JsonValueObject(DirectoryEntry(args->arena, name,
+                     displayName, avatarUrl, config->serverName)));
         }
+        Free(lowerName);
+        Free(lowerDisplayName);
         if (!StrEquals(name, requesterName))
         {
             UserUnlock(currentUser);
         }
     }
+    limited = included == limit;
+
+respond:
     JsonSet(response, JsonValueArray(results), 1, "results");
-    JsonSet(response, 
-        JsonValueBoolean((int64_t) included == dirRequest.limit), 
-        1, "limited"
-    );
+    JsonSet(response, JsonValueBoolean(limited), 1, "limited");
 
 finish:
     UserUnlock(user);
     JsonFree(request);
     DbListFree(users);
-    ConfigUnlock(&config);
+    ConfigRelease(args->matrixArgs->config, config);
     UserDirectoryRequestFree(&dirRequest);
     return response;
 }
@@ -51,18 +51,17 @@ ROUTE_IMPL(RouteUserProfile, path, argp)
 
     char *msg;
 
-    Config config;
+    Config *config = NULL;
 
-    ConfigLock(db, &config);
+    config = ConfigAcquire(args->matrixArgs->config);
 
-    if (!config.ok)
+    if (!config)
     {
-        Log(LOG_ERR, "%s", config.err);
         HttpResponseStatus(args->context, HTTP_INTERNAL_SERVER_ERROR);
-        return MatrixErrorCreate(M_UNKNOWN, config.err);
+        return MatrixErrorCreate(M_UNKNOWN, NULL);
     }
 
-    serverName = config.serverName;
+    serverName = config->serverName;
 
     username = ArrayGet(path, 0);
     userId = UserIdParse(username, serverName);
@@ -87,7 +86,7 @@ ROUTE_IMPL(RouteUserProfile, path, argp)
     switch (HttpRequestMethodGet(args->context))
     {
         case HTTP_GET:
-            user = UserLock(db, userId->local);
+            user = UserLockShared(db, userId->local);
             if (!user)
             {
                 msg = "Couldn't lock user.";
@@ -123,7 +122,7 @@ ROUTE_IMPL(RouteUserProfile, path, argp)
         case HTTP_PUT:
             if (ArraySize(path) > 1)
             {
-                request = JsonDecode(HttpServerStream(args->context));
+                request = MatrixRequestJson(args->context);
                 if (!request)
                 {
                     HttpResponseStatus(args->context, HTTP_BAD_REQUEST);
@@ -183,7 +182,7 @@ ROUTE_IMPL(RouteUserProfile, path, argp)
             break;
     }
 finish:
-    ConfigUnlock(&config);
+    ConfigRelease(args->matrixArgs->config, config);
 
     UserIdFree(userId);
     UserUnlock(user);
@@ -36,19 +36,18 @@ ROUTE_IMPL(RouteWellKnown, path, argp)
     RouteArgs *args = argp;
     HashMap *response;
 
-    Config config;
+    Config *config = NULL;
 
-    ConfigLock(args->matrixArgs->db, &config);
-    if (!config.ok)
+    config = ConfigAcquire(args->matrixArgs->config);
+    if (!config)
     {
-        Log(LOG_ERR, "%s", config.err);
         HttpResponseStatus(args->context, HTTP_INTERNAL_SERVER_ERROR);
-        return MatrixErrorCreate(M_UNKNOWN, config.err);
+        return MatrixErrorCreate(M_UNKNOWN, NULL);
     }
 
     if (StrEquals(ArrayGet(path, 0), "client"))
     {
-        response = MatrixClientWellKnown(config.baseUrl, config.identityServer);
+        response = MatrixClientWellKnown(config->baseUrl, config->identityServer);
     }
     else
     {
@@ -56,6 +55,6 @@ ROUTE_IMPL(RouteWellKnown, path, argp)
         response = MatrixErrorCreate(M_NOT_FOUND, NULL);
     }
 
-    ConfigUnlock(&config);
+    ConfigRelease(args->matrixArgs->config, config);
     return response;
 }
@@ -44,15 +44,14 @@ ROUTE_IMPL(RouteWhoami, path, argp)
     char *userID;
     char *deviceID;
 
-    Config config;
+    Config *config = NULL;
 
-    ConfigLock(db, &config);
+    config = ConfigAcquire(args->matrixArgs->config);
 
-    if (!config.ok)
+    if (!config)
     {
-        Log(LOG_ERR, "%s", config.err);
         HttpResponseStatus(args->context, HTTP_INTERNAL_SERVER_ERROR);
-        return MatrixErrorCreate(M_UNKNOWN, config.err);
+        return MatrixErrorCreate(M_UNKNOWN, NULL);
     }
 
     (void) path;
@@ -66,7 +65,7 @@ ROUTE_IMPL(RouteWhoami, path, argp)
     }
 
     /* Authenticate with our token */
-    user = UserAuthenticate(db, token);
+    user = UserAuthenticateShared(db, token);
     if (!user)
     {
         HttpResponseStatus(args->context, HTTP_UNAUTHORIZED);
@@ -76,18 +75,15 @@ ROUTE_IMPL(RouteWhoami, path, argp)
 
     response = HashMapCreate();
 
-    userID = StrConcat(4, "@", UserGetName(user), ":", config.serverName);
-    deviceID = StrDuplicate(UserGetDeviceId(user));
+    userID = ArenaStrConcat(args->arena, 4, "@", UserGetName(user), ":", config->serverName);
+    deviceID = ArenaStrDuplicate(args->arena, UserGetDeviceId(user));
 
     UserUnlock(user);
 
     HashMapSet(response, "device_id", JsonValueString(deviceID));
     HashMapSet(response, "user_id", JsonValueString(userID));
 
-    Free(userID);
-    Free(deviceID);
-
 finish:
-    ConfigUnlock(&config);
+    ConfigRelease(args->matrixArgs->config, config);
     return response;
 }
@@ -0,0 +1,540 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <SignedToken.h>
+#include <Trace.h>
+
+#include <Cytoplasm/Memory.h>
+#include <Cytoplasm/HashMap.h>
+#include <Cytoplasm/Json.h>
+#include <Cytoplasm/Stream.h>
+#include <Cytoplasm/Str.h>
+#include <Cytoplasm/Sha.h>
+#include <Cytoplasm/Util.h>
+#include <Cytoplasm/Log.h>
+
+#include <pthread.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define SIGNED_TOKEN_PREFIX "tds1_"
+#define SIGNED_TOKEN_SEP '_'
+#define SIGNED_TOKEN_FIELD '\t'
+
+#define SIGNED_TOKEN_LOG "revoked-tokens.log"
+#define SIGNED_TOKEN_LOG_TMP "revoked-tokens.log.tmp"
+
+static pthread_rwlock_t revokedLock = PTHREAD_RWLOCK_INITIALIZER;
+static HashMap *revoked = NULL;
+static Stream *revokedLog = NULL;
+
+static char *secret = NULL;
+static int enabled = 0;
+
+static char *
+HexEncode(char *str)
+{
+    static const char digits[] = "0123456789abcdef";
+    size_t len = strlen(str);
+    size_t i;
+    char *hex = Malloc((len * 2) + 1);
+
+    if (!hex)
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char) str[i];
+
+        hex[i * 2] = digits[c >> 4];
+        hex[(i * 2) + 1] = digits[c & 0x0F];
+    }
+    hex[len * 2] = '\0';
+
+    return hex;
+}
+
+static int
+HexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    else if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+
+    return -1;
+}
+
+static char *
+HexDecode(char *hex, size_t len)
+{
+    char *str;
+    size_t i;
+
+    if (len % 2)
+    {
+        return NULL;
+    }
+
+    str = Malloc((len / 2) + 1);
+    if (!str)
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < len; i += 2)
+    {
+        int hi = HexDigit(hex[i]);
+        int lo = HexDigit(hex[i + 1]);
+
+        /* Reject invalid digits and embedded NUL bytes. */
+        if (hi < 0 || lo < 0 || (!hi && !lo))
+        {
+            Free(str);
+            return NULL;
+        }
+
+        str[i / 2] = (char) ((hi << 4) | lo);
+    }
+    str[len / 2] = '\0';
+
+    return str;
+}
+
+/*
+ * Sha256() only takes strings, so a true HMAC over binary keys isn't
+ * possible here. Instead, use the same nested construction with the
+ * secret bound to each layer by a distinct label, which is likewise
+ * not subject to length extension.
+ */
+static char *
+Sign(char *payload)
+{
+    char *tmp;
+    unsigned char *hash;
+    char *inner;
+    char *outer;
+
+    tmp = StrConcat(3, secret, ":inner:", payload);
+    hash = Sha256(tmp);
+    inner = ShaToHex(hash, HASH_SHA256);
+    Free(tmp);
+    Free(hash);
+
+    tmp = StrConcat(3, secret, ":outer:", inner);
+    hash = Sha256(tmp);
+    outer = ShaToHex(hash, HASH_SHA256);
+    Free(tmp);
+    Free(hash);
+    Free(inner);
+
+    return outer;
+}
+
+/* Compare without short-circuiting, so that the time taken doesn't
+ * reveal how much of a forged signature was right. */
+static int
+SignatureEquals(char *a, char *b)
+{
+    size_t len = strlen(a);
+    size_t i;
+    unsigned char diff = 0;
+
+    if (len != strlen(b))
+    {
+        return 0;
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        diff |= (unsigned char) (a[i] ^ b[i]);
+    }
+
+    return !diff;
+}
+
+/*
+ * Verify the signature and split the payload into its fields. On
+ * success, the payload is returned and the field pointers point into
+ * it, so only the payload needs to be freed.
+ */
+static char *
+Parse(char *token, char **user, char **device, uint64_t *expires, char **id)
+{
+    char *payloadHex;
+    char *sigStart;
+    char *sig;
+    char *payload;
+    char *fields[4];
+    char *p;
+    size_t i;
+    int valid;
+
+    if (!secret || !SignedTokenIs(token))
+    {
+        return NULL;
+    }
+
+    payloadHex = token + strlen(SIGNED_TOKEN_PREFIX);
+    sigStart = strrchr(payloadHex, SIGNED_TOKEN_SEP);
+    if (!sigStart)
+    {
+        return NULL;
+    }
+
+    payloadHex = StrSubstr(payloadHex, 0, sigStart - payloadHex);
+    if (!payloadHex)
+    {
+        return NULL;
+    }
+
+    sig = Sign(payloadHex);
+    valid = sig && SignatureEquals(sig, sigStart + 1);
+    Free(sig);
+
+    if (!valid)
+    {
+        Free(payloadHex);
+        return NULL;
+    }
+
+    payload = HexDecode(payloadHex, strlen(payloadHex));
+    Free(payloadHex);
+    if (!payload)
+    {
+        return NULL;
+    }
+
+    p = payload;
+    for (i = 0; i < 4; i++)
+    {
+        fields[i] = p;
+        p = strchr(p, SIGNED_TOKEN_FIELD);
+        if (i < 3)
+        {
+            if (!p)
+            {
+                Free(payload);
+                return NULL;
+            }
+            *p = '\0';
+            p++;
+        }
+    }
+
+    *user = fields[0];
+    *device = fields[1];
+    *expires = strtoull(fields[2], NULL, 10);
+    *id = fields[3];
+
+    /* Every signed token must expire, so that its revocation can be
+     * forgotten eventually. */
+    if (!*expires)
+    {
+        Free(payload);
+        return NULL;
+    }
+
+    return payload;
+}
+
+/* Must be called with the revocation lock held for writing. */
+static void
+RevokedAdd(char *id, uint64_t expires)
+{
+    uint64_t *val = Malloc(sizeof(uint64_t));
+
+    if (!val)
+    {
+        return;
+    }
+
+    *val = expires;
+    Free(HashMapSet(revoked, id, val));
+}
+
+static void
+RevokedLoad(void)
+{
+    Stream *in;
+    Stream *out;
+    char line[128];
+    char *id;
+    uint64_t *expires;
+    uint64_t now = UtilTsMillis();
+
+    in = StreamOpen(SIGNED_TOKEN_LOG, "r");
+    if (in)
+    {
+        while (StreamGets(in, line, sizeof(line)))
+        {
+            char *sp = strchr(line, ' ');
+            uint64_t exp;
+
+            if (!sp)
+            {
+                continue;
+            }
+
+            *sp = '\0';
+            exp = strtoull(sp + 1, NULL, 10);
+
+            /* An expired token is rejected regardless, so there's no
+             * need to remember that it was revoked. Tokens that never
+             * expire are not accepted at all. */
+            if (!exp || exp <= now)
+            {
+                continue;
+            }
+
+            RevokedAdd(line, exp);
+        }
+        StreamClose(in);
+    }
+
+    /* Compact the log by rewriting only what's left. */
+    out = StreamOpen(SIGNED_TOKEN_LOG_TMP, "w");
+    if (!out)
+    {
+        Log(LOG_WARNING, "Unable to compact the token revocation log.");
+        return;
+    }
+
+    while (HashMapIterate(revoked, &id, (void **) &expires))
+    {
+        StreamPrintf(out, "%s %" PRIu64 "\n", id, *expires);
+    }
+    StreamClose(out);
+
+    if (rename(SIGNED_TOKEN_LOG_TMP, SIGNED_TOKEN_LOG) != 0)
+    {
+        Log(LOG_WARNING, "Unable to replace the token revocation log.");
+        remove(SIGNED_TOKEN_LOG_TMP);
+    }
+}
+
+int
+SignedTokenInit(Db * db, int enable)
+{
+    DbRef *ref;
+    char *stored;
+
+    if (!db || secret)
+    {
+        return 0;
+    }
+
+    ref = TraceDbLock(db, 2, "tokens", "secret");
+    if (!ref)
+    {
+        ref = DbCreate(db, 2, "tokens", "secret");
+    }
+
+    if (!ref)
+    {
+        return 0;
+    }
+
+    stored = JsonValueAsString(HashMapGet(DbJson(ref), "secret"));
+    if (!stored)
+    {
+        secret = StrRandom(64);
+        HashMapSet(DbJson(ref), "secret", JsonValueString(secret));
+    }
+    else
+    {
+        secret = StrDuplicate(stored);
+    }
+    DbUnlock(db, ref);
+
+    pthread_rwlock_wrlock(&revokedLock);
+    revoked = HashMapCreate();
+    RevokedLoad();
+    revokedLog = StreamOpen(SIGNED_TOKEN_LOG, "a");
+    pthread_rwlock_unlock(&revokedLock);
+
+    if (!revokedLog)
+    {
+        Log(LOG_ERR, "Unable to open the token revocation log.");
+        SignedTokenFree();
+        return 0;
+    }
+
+    enabled = enable;
+    return 1;
+}
+
+void
+SignedTokenFree(void)
+{
+    char *id;
+    uint64_t *expires;
+
+    pthread_rwlock_wrlock(&revokedLock);
+    if (revoked)
+    {
+        while (HashMapIterate(revoked, &id, (void **) &expires))
+        {
+            Free(expires);
+        }
+        HashMapFree(revoked);
+        revoked = NULL;
+    }
+
+    if (revokedLog)
+    {
+        StreamClose(revokedLog);
+        revokedLog = NULL;
+    }
+    pthread_rwlock_unlock(&revokedLock);
+
+    Free(secret);
+    secret = NULL;
+    enabled = 0;
+}
+
+int
+SignedTokenEnabled(void)
+{
+    return enabled && secret;
+}
+
+char *
+SignedTokenCreate(char *user, char *device, uint64_t expires)
+{
+    char expStr[21];
+    char *id;
+    char *payload;
+    char *payloadHex;
+    char *sig;
+    char *token;
+
+    if (!secret || !user || !device || !expires ||
+        strchr(user, SIGNED_TOKEN_FIELD) || strchr(device, SIGNED_TOKEN_FIELD))
+    {
+        return NULL;
+    }
+
+    snprintf(expStr, sizeof(expStr), "%" PRIu64, expires);
+    id = StrRandom(16);
+
+    payload = StrConcat(7, user, "\t", device, "\t", expStr, "\t", id);
+    payloadHex = HexEncode(payload);
+    sig = Sign(payloadHex);
+
+    token = StrConcat(4, SIGNED_TOKEN_PREFIX, payloadHex, "_", sig);
+
+    Free(id);
+    Free(payload);
+    Free(payloadHex);
+    Free(sig);
+
+    return token;
+}
+
+int
+SignedTokenIs(char *token)
+{
+    size_t len = strlen(SIGNED_TOKEN_PREFIX);
+
+    return token && strncmp(token, SIGNED_TOKEN_PREFIX, len) == 0;
+}
+
+int
+SignedTokenVerify(char *token, char **user, char **device, uint64_t *expires)
+{
+    char *payload;
+    char *tUser;
+    char *tDevice;
+    char *id;
+    uint64_t tExpires;
+    int isRevoked;
+
+    if (!user || !device || !expires)
+    {
+        return 0;
+    }
+
+    payload = Parse(token, &tUser, &tDevice, &tExpires, &id);
+    if (!payload)
+    {
+        return 0;
+    }
+
+    pthread_rwlock_rdlock(&revokedLock);
+    isRevoked = !revoked || HashMapGet(revoked, id) != NULL;
+    pthread_rwlock_unlock(&revokedLock);
+
+    if (isRevoked)
+    {
+        Free(payload);
+        return 0;
+    }
+
+    *user = StrDuplicate(tUser);
+    *device = StrDuplicate(tDevice);
+    *expires = tExpires;
+
+    Free(payload);
+    return 1;
+}
+
+int
+SignedTokenRevoke(char *token)
+{
+    char *payload;
+    char *user;
+    char *device;
+    char *id;
+    uint64_t expires;
+
+    payload = Parse(token, &user, &device, &expires, &id);
+    if (!payload)
+    {
+        return 0;
+    }
+
+    pthread_rwlock_wrlock(&revokedLock);
+    if (revoked && !HashMapGet(revoked, id))
+    {
+        RevokedAdd(id, expires);
+        if (revokedLog)
+        {
+            StreamPrintf(revokedLog, "%s %" PRIu64 "\n", id, expires);
+            StreamFlush(revokedLog);
+        }
+    }
+    pthread_rwlock_unlock(&revokedLock);
+
+    Free(payload);
+    return 1;
+}
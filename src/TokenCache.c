@@ -0,0 +1,444 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <TokenCache.h>
+
+#include <Cytoplasm/Memory.h>
+#include <Cytoplasm/Json.h>
+#include <Cytoplasm/Str.h>
+#include <Cytoplasm/Util.h>
+
+#include <pthread.h>
+#include <string.h>
+
+#define TOKEN_CACHE_SHARDS 16
+
+/* How long to remember that a token does not exist. This is kept
+ * short so that a token created by another process sharing the
+ * database will not stay rejected for long. */
+#define TOKEN_CACHE_UNKNOWN_TTL (30 * 1000)
+
+typedef struct TokenCacheEntry
+{
+    char *token;
+    TokenCacheInfo info;
+
+    int unknown;
+    uint64_t added;
+
+    struct TokenCacheEntry *prev;
+    struct TokenCacheEntry *next;
+} TokenCacheEntry;
+
+typedef struct TokenCacheShard
+{
+    pthread_mutex_t lock;
+    HashMap *entries;
+
+    /* Most recently used at the head, evict from the tail. */
+    TokenCacheEntry *head;
+    TokenCacheEntry *tail;
+
+    size_t size;
+    size_t max;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t unknownHits;
+    uint64_t evictions;
+} TokenCacheShard;
+
+static TokenCacheShard *shards = NULL;
+
+static TokenCacheShard *
+ShardGet(char *token)
+{
+    unsigned long hash = 5381;
+    unsigned char *p = (unsigned char *) token;
+
+    while (*p)
+    {
+        hash = ((hash << 5) + hash) + *p;
+        p++;
+    }
+
+    return &shards[hash % TOKEN_CACHE_SHARDS];
+}
+
+static void
+EntryUnlink(TokenCacheShard * shard, TokenCacheEntry * entry)
+{
+    if (entry->prev)
+    {
+        entry->prev->next = entry->next;
+    }
+    else
+    {
+        shard->head = entry->next;
+    }
+
+    if (entry->next)
+    {
+        entry->next->prev = entry->prev;
+    }
+    else
+    {
+        shard->tail = entry->prev;
+    }
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void
+EntryPush(TokenCacheShard * shard, TokenCacheEntry * entry)
+{
+    entry->prev = NULL;
+    entry->next = shard->head;
+
+    if (shard->head)
+    {
+        shard->head->prev = entry;
+    }
+    else
+    {
+        shard->tail = entry;
+    }
+
+    shard->head = entry;
+}
+
+static void
+EntryFree(TokenCacheEntry * entry)
+{
+    Free(entry->token);
+    TokenCacheInfoFree(&entry->info);
+    Free(entry);
+}
+
+/* Must be called with the shard lock held. */
+static void
+EntryRemove(TokenCacheShard * shard, TokenCacheEntry * entry)
+{
+    HashMapDelete(shard->entries, entry->token);
+    EntryUnlink(shard, entry);
+    EntryFree(entry);
+    shard->size--;
+}
+
+static void
+EntryInsert(TokenCacheShard * shard, char *token, TokenCacheInfo * info)
+{
+    TokenCacheEntry *entry;
+
+    entry = HashMapGet(shard->entries, token);
+    if (entry)
+    {
+        EntryRemove(shard, entry);
+    }
+
+    while (shard->size >= shard->max && shard->tail)
+    {
+        EntryRemove(shard, shard->tail);
+        shard->evictions++;
+    }
+
+    entry = Malloc(sizeof(TokenCacheEntry));
+    if (!entry)
+    {
+        return;
+    }
+
+    entry->token = StrDuplicate(token);
+    entry->added = UtilTsMillis();
+    entry->prev = NULL;
+    entry->next = NULL;
+
+    if (info)
+    {
+        entry->unknown = 0;
+        entry->info.user = StrDuplicate(info->user);
+        entry->info.deviceId = StrDuplicate(info->deviceId);
+        entry->info.expires = info->expires;
+        entry->info.privileges = info->privileges;
+    }
+    else
+    {
+        entry->unknown = 1;
+        memset(&entry->info, 0, sizeof(TokenCacheInfo));
+    }
+
+    HashMapSet(shard->entries, entry->token, entry);
+    EntryPush(shard, entry);
+    shard->size++;
+}
+
+void
+TokenCacheInit(size_t size)
+{
+    size_t i;
+
+    if (shards)
+    {
+        return;
+    }
+
+    if (!size)
+    {
+        size = TOKEN_CACHE_DEFAULT_SIZE;
+    }
+
+    shards = Malloc(sizeof(TokenCacheShard) * TOKEN_CACHE_SHARDS);
+    if (!shards)
+    {
+        return;
+    }
+
+    for (i = 0; i < TOKEN_CACHE_SHARDS; i++)
+    {
+        TokenCacheShard *shard = &shards[i];
+
+        memset(shard, 0, sizeof(TokenCacheShard));
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->entries = HashMapCreate();
+        shard->max = (size / TOKEN_CACHE_SHARDS) + 1;
+    }
+}
+
+void
+TokenCacheFree(void)
+{
+    size_t i;
+
+    if (!shards)
+    {
+        return;
+    }
+
+    for (i = 0; i < TOKEN_CACHE_SHARDS; i++)
+    {
+        TokenCacheShard *shard = &shards[i];
+
+        while (shard->head)
+        {
+            EntryRemove(shard, shard->head);
+        }
+
+        HashMapFree(shard->entries);
+        pthread_mutex_destroy(&shard->lock);
+    }
+
+    Free(shards);
+    shards = NULL;
+}
+
+TokenCacheResult
+TokenCacheGet(char *token, TokenCacheInfo * info)
+{
+    TokenCacheShard *shard;
+    TokenCacheEntry *entry;
+    TokenCacheResult result = TOKEN_CACHE_MISS;
+
+    if (!shards || !token || !info)
+    {
+        return TOKEN_CACHE_MISS;
+    }
+
+    shard = ShardGet(token);
+    pthread_mutex_lock(&shard->lock);
+
+    entry = HashMapGet(shard->entries, token);
+    if (entry && entry->unknown &&
+        UtilTsMillis() - entry->added >= TOKEN_CACHE_UNKNOWN_TTL)
+    {
+        EntryRemove(shard, entry);
+        entry = NULL;
+    }
+
+    if (!entry)
+    {
+        shard->misses++;
+        goto finish;
+    }
+
+    EntryUnlink(shard, entry);
+    EntryPush(shard, entry);
+
+    if (entry->unknown)
+    {
+        shard->unknownHits++;
+        result = TOKEN_CACHE_UNKNOWN;
+        goto finish;
+    }
+
+    shard->hits++;
+    info->user = StrDuplicate(entry->info.user);
+    info->deviceId = StrDuplicate(entry->info.deviceId);
+    info->expires = entry->info.expires;
+    info->privileges = entry->info.privileges;
+    result = TOKEN_CACHE_HIT;
+
+finish:
+    pthread_mutex_unlock(&shard->lock);
+    return result;
+}
+
+void
+TokenCachePut(char *token, TokenCacheInfo * info)
+{
+    TokenCacheShard *shard;
+
+    if (!shards || !token || !info)
+    {
+        return;
+    }
+
+    shard = ShardGet(token);
+    pthread_mutex_lock(&shard->lock);
+    EntryInsert(shard, token, info);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void
+TokenCachePutUnknown(char *token)
+{
+    TokenCacheShard *shard;
+
+    if (!shards || !token)
+    {
+        return;
+    }
+
+    shard = ShardGet(token);
+    pthread_mutex_lock(&shard->lock);
+    EntryInsert(shard, token, NULL);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void
+TokenCacheInvalidate(char *token)
+{
+    TokenCacheShard *shard;
+    TokenCacheEntry *entry;
+
+    if (!shards || !token)
+    {
+        return;
+    }
+
+    shard = ShardGet(token);
+    pthread_mutex_lock(&shard->lock);
+
+    entry = HashMapGet(shard->entries, token);
+    if (entry)
+    {
+        EntryRemove(shard, entry);
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void
+TokenCacheInvalidateUser(char *user)
+{
+    size_t i;
+
+    if (!shards || !user)
+    {
+        return;
+    }
+
+    for (i = 0; i < TOKEN_CACHE_SHARDS; i++)
+    {
+        TokenCacheShard *shard = &shards[i];
+        TokenCacheEntry *entry;
+        TokenCacheEntry *next;
+
+        pthread_mutex_lock(&shard->lock);
+        for (entry = shard->head; entry; entry = next)
+        {
+            next = entry->next;
+            if (!entry->unknown && StrEquals(entry->info.user, user))
+            {
+                EntryRemove(shard, entry);
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+void
+TokenCacheInfoFree(TokenCacheInfo * info)
+{
+    if (!info)
+    {
+        return;
+    }
+
+    Free(info->user);
+    Free(info->deviceId);
+
+    info->user = NULL;
+    info->deviceId = NULL;
+}
+
+HashMap *
+TokenCacheStats(void)
+{
+    HashMap *stats;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t unknownHits = 0;
+    uint64_t evictions = 0;
+    uint64_t entries = 0;
+    size_t i;
+
+    stats = HashMapCreate();
+    if (!stats)
+    {
+        return NULL;
+    }
+
+    for (i = 0; shards && i < TOKEN_CACHE_SHARDS; i++)
+    {
+        TokenCacheShard *shard = &shards[i];
+
+        pthread_mutex_lock(&shard->lock);
+        hits += shard->hits;
+        misses += shard->misses;
+        unknownHits += shard->unknownHits;
+        evictions += shard->evictions;
+        entries += shard->size;
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    HashMapSet(stats, "enabled", JsonValueBoolean(shards != NULL));
+    HashMapSet(stats, "hits", JsonValueInteger(hits));
+    HashMapSet(stats, "misses", JsonValueInteger(misses));
+    HashMapSet(stats, "unknown_hits", JsonValueInteger(unknownHits));
+    HashMapSet(stats, "evictions", JsonValueInteger(evictions));
+    HashMapSet(stats, "entries", JsonValueInteger(entries));
+
+    return stats;
+}
@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <TokenExpiry.h>
+
+#include <Cytoplasm/Memory.h>
+#include <Cytoplasm/HashMap.h>
+#include <Cytoplasm/Array.h>
+#include <Cytoplasm/Json.h>
+#include <Cytoplasm/Str.h>
+#include <Cytoplasm/Util.h>
+#include <Cytoplasm/Log.h>
+
+#include <User.h>
+#include <SignedToken.h>
+#include <Trace.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+
+/* Tokens expiring within the same 5 minutes share a bucket. */
+#define TOKEN_EXPIRY_BUCKET (5 * 60 * 1000)
+
+/* How long after expiry a client may still refresh its token before
+ * the session is deleted. */
+#define TOKEN_EXPIRY_GRACE ((uint64_t) 30 * 24 * 60 * 60 * 1000)
+
+/* The maximum number of tokens swept per run. */
+#define TOKEN_EXPIRY_BATCH 1024
+
+typedef struct TokenExpiryEntry
+{
+    char *token;
+    char *user;
+} TokenExpiryEntry;
+
+static uint64_t
+Bucket(uint64_t ts)
+{
+    return ts / TOKEN_EXPIRY_BUCKET;
+}
+
+static int
+IndexAdd(Db * db, uint64_t bucket, char *token, char *user)
+{
+    char name[21];
+    DbRef *ref;
+
+    snprintf(name, sizeof(name), "%" PRIu64, bucket);
+
+    ref = TraceDbLock(db, 3, "tokens", "expiry", name);
+    if (!ref)
+    {
+        ref = DbCreate(db, 3, "tokens", "expiry", name);
+    }
+    if (!ref)
+    {
+        /* Someone else may have created it in the meantime. */
+        ref = TraceDbLock(db, 3, "tokens", "expiry", name);
+    }
+    if (!ref)
+    {
+        return 0;
+    }
+
+    JsonValueFree(JsonSet(DbJson(ref), JsonValueString(user), 2, "tokens", token));
+    return DbUnlock(db, ref);
+}
+
+int
+TokenExpiryAdd(Db * db, char *token, char *user, uint64_t expires)
+{
+    if (!db || !token || !user || !expires)
+    {
+        return 0;
+    }
+
+    return IndexAdd(db, Bucket(expires + TOKEN_EXPIRY_GRACE), token, user);
+}
+
+/*
+ * Index every existing access token that expires. This is done once,
+ * so that tokens issued before the index existed are also swept.
+ * Tokens that are already due are put in the current bucket.
+ */
+static uint64_t
+IndexBuild(Db * db)
+{
+    Array *tokens = DbList(db, 2, "tokens", "access");
+    uint64_t now = Bucket(UtilTsMillis());
+    size_t indexed = 0;
+    size_t i;
+
+    for (i = 0; i < ArraySize(tokens); i++)
+    {
+        char *token = ArrayGet(tokens, i);
+        DbRef *ref = TraceDbLock(db, 3, "tokens", "access", token);
+        uint64_t expires;
+        char *user;
+
+        if (!ref)
+        {
+            continue;
+        }
+
+        expires = JsonValueAsInteger(HashMapGet(DbJson(ref), "expires"));
+        user = StrDuplicate(JsonValueAsString(HashMapGet(DbJson(ref), "user")));
+        DbUnlock(db, ref);
+
+        if (expires && user)
+        {
+            uint64_t bucket = Bucket(expires + TOKEN_EXPIRY_GRACE);
+
+            IndexAdd(db, bucket < now ? now : bucket, token, user);
+            indexed++;
+        }
+
+        Free(user);
+    }
+
+    DbListFree(tokens);
+
+    Log(LOG_INFO, "Indexed %lu expiring access tokens.", indexed);
+    return now;
+}
+
+/*
+ * Take up to the given number of tokens out of a bucket, deleting the
+ * bucket once it is empty. The bucket is unlocked before the tokens
+ * are swept, because sweeping locks users, and users are locked
+ * before buckets when tokens are issued.
+ */
+static Array *
+BucketTake(Db * db, uint64_t bucket, size_t max, int *empty)
+{
+    char name[21];
+    DbRef *ref;
+    HashMap *tokens;
+    Array *taken;
+    char *token;
+    JsonValue *user;
+    size_t iter = 0;
+    size_t i;
+
+    *empty = 1;
+    snprintf(name, sizeof(name), "%" PRIu64, bucket);
+
+    ref = TraceDbLock(db, 3, "tokens", "expiry", name);
+    if (!ref)
+    {
+        return NULL;
+    }
+
+    taken = ArrayCreate();
+    tokens = JsonValueAsObject(HashMapGet(DbJson(ref), "tokens"));
+
+    while (HashMapIterateReentrant(tokens, &token, (void **) &user, &iter))
+    {
+        TokenExpiryEntry *entry;
+
+        if (ArraySize(taken) >= max)
+        {
+            *empty = 0;
+            break;
+        }
+
+        entry = Malloc(sizeof(TokenExpiryEntry));
+        entry->token = StrDuplicate(token);
+        entry->user = StrDuplicate(JsonValueAsString(user));
+        ArrayAdd(taken, entry);
+    }
+
+    for (i = 0; i < ArraySize(taken); i++)
+    {
+        TokenExpiryEntry *entry = ArrayGet(taken, i);
+
+        JsonValueFree(HashMapDelete(tokens, entry->token));
+    }
+
+    DbUnlock(db, ref);
+    if (*empty)
+    {
+        DbDelete(db, 3, "tokens", "expiry", name);
+    }
+
+    return taken;
+}
+
+static void
+SweepToken(Db * db, TokenExpiryEntry * entry)
+{
+    User *user = UserLock(db, entry->user);
+
+    if (user)
+    {
+        HashMap *devices = UserGetDevices(user);
+        char *deviceId;
+        JsonValue *device;
+        char *found = NULL;
+        size_t iter = 0;
+
+        /* The device is only removed if this is still its current
+         * token; if it was refreshed, the session is still alive. */
+        while (HashMapIterateReentrant(devices, &deviceId, (void **) &device, &iter))
+        {
+            char *accessToken = JsonValueAsString(HashMapGet(JsonValueAsObject(device), "accessToken"));
+
+            if (StrEquals(accessToken, entry->token))
+            {
+                found = deviceId;
+                break;
+            }
+        }
+
+        if (found)
+        {
+            char *refreshToken = JsonValueAsString(JsonGet(devices, 2, found, "refreshToken"));
+
+            if (refreshToken)
+            {
+                DbDelete(db, 3, "tokens", "refresh", refreshToken);
+            }
+
+            JsonValueFree(HashMapDelete(devices, found));
+        }
+
+        UserUnlock(user);
+    }
+
+    /* An expired signed token is already rejected, so it doesn't need
+     * to take up space in the revocation set. */
+    if (!SignedTokenIs(entry->token))
+    {
+        UserAccessTokenDelete(db, entry->token);
+    }
+}
+
+void
+TokenExpirySweep(Db * db)
+{
+    DbRef *ref;
+    uint64_t next;
+    uint64_t now;
+    size_t budget = TOKEN_EXPIRY_BATCH;
+    size_t swept = 0;
+
+    if (!db)
+    {
+        return;
+    }
+
+    /* The cursor also keeps two sweeps from running at once. */
+    ref = TraceDbLock(db, 2, "tokens", "sweep");
+    if (!ref)
+    {
+        ref = DbCreate(db, 2, "tokens", "sweep");
+        if (!ref)
+        {
+            return;
+        }
+
+        next = IndexBuild(db);
+    }
+    else
+    {
+        next = JsonValueAsInteger(HashMapGet(DbJson(ref), "next"));
+    }
+
+    now = Bucket(UtilTsMillis());
+
+    /* Only buckets that have fully passed are due. */
+    while (next < now && budget)
+    {
+        int empty;
+        Array *taken = BucketTake(db, next, budget, &empty);
+        size_t i;
+
+        for (i = 0; i < ArraySize(taken); i++)
+        {
+            TokenExpiryEntry *entry = ArrayGet(taken, i);
+
+            SweepToken(db, entry);
+
+            Free(entry->token);
+            Free(entry->user);
+            Free(entry);
+        }
+
+        budget -= ArraySize(taken);
+        swept += ArraySize(taken);
+        ArrayFree(taken);
+
+        if (!empty)
+        {
+            break;
+        }
+
+        next++;
+    }
+
+    JsonValueFree(HashMapSet(DbJson(ref), "next", JsonValueInteger(next)));
+    DbUnlock(db, ref);
+
+    if (swept)
+    {
+        Log(LOG_DEBUG, "Swept %lu expired access tokens.", swept);
+    }
+}
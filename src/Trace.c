@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <Trace.h>
+
+#include <Cytoplasm/Memory.h>
+#include <Cytoplasm/HashMap.h>
+#include <Cytoplasm/Json.h>
+#include <Cytoplasm/Util.h>
+
+#include <Metrics.h>
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+
+#define TRACE_PHASES 8
+#define TRACE_LOCKS 32
+#define TRACE_NAME 128
+
+typedef struct TracePhaseRecord
+{
+    char *name;
+    uint64_t usec;
+} TracePhaseRecord;
+
+typedef struct TraceLockRecord
+{
+    char object[TRACE_NAME];
+    uint64_t usec;
+} TraceLockRecord;
+
+/*
+ * Everything is kept inline, so that a trace can be reset and copied
+ * into the ring without allocating.
+ */
+typedef struct Trace
+{
+    int active;
+    uint64_t start;
+    uint64_t time;
+    uint64_t total;
+    uint64_t lockStart;
+
+    char method[16];
+    char path[256];
+    char user[256];
+    char *route;
+    int status;
+
+    size_t nPhases;
+    TracePhaseRecord phases[TRACE_PHASES];
+
+    size_t nLocks;
+    size_t locksDropped;
+    TraceLockRecord locks[TRACE_LOCKS];
+} Trace;
+
+static pthread_mutex_t ringLock = PTHREAD_MUTEX_INITIALIZER;
+static Trace *ring;
+static size_t ringNext;
+static size_t ringCount;
+static uint64_t threshold;
+
+static pthread_key_t traceKey;
+static pthread_once_t traceOnce = PTHREAD_ONCE_INIT;
+
+static void
+TraceDestroy(void *trace)
+{
+    Free(trace);
+}
+
+static void
+TraceKeyCreate(void)
+{
+    pthread_key_create(&traceKey, TraceDestroy);
+}
+
+/* Get the calling thread's trace, if it is in a request. */
+static Trace *
+TraceCurrent(void)
+{
+    Trace *trace;
+
+    pthread_once(&traceOnce, TraceKeyCreate);
+
+    trace = pthread_getspecific(traceKey);
+    return trace && trace->active ? trace : NULL;
+}
+
+static void
+TraceCopy(char *dst, const char *src, size_t size)
+{
+    if (!src)
+    {
+        src = "";
+    }
+
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = '\0';
+}
+
+void
+TraceInit(long thresholdMs)
+{
+    pthread_mutex_lock(&ringLock);
+    if (thresholdMs >= 0 && !ring)
+    {
+        ring = Malloc(sizeof(Trace) * TRACE_RING_SIZE);
+        threshold = (uint64_t) thresholdMs * 1000;
+        ringNext = 0;
+        ringCount = 0;
+    }
+    pthread_mutex_unlock(&ringLock);
+}
+
+void
+TraceFree(void)
+{
+    pthread_mutex_lock(&ringLock);
+    Free(ring);
+    ring = NULL;
+    pthread_mutex_unlock(&ringLock);
+}
+
+void
+TraceBegin(const char *method, char *path)
+{
+    Trace *trace;
+
+    /* Read without the lock; the ring only changes at startup and
+     * shutdown, when no requests are being handled. */
+    if (!ring)
+    {
+        return;
+    }
+
+    pthread_once(&traceOnce, TraceKeyCreate);
+
+    trace = pthread_getspecific(traceKey);
+    if (!trace)
+    {
+        trace = Malloc(sizeof(Trace));
+        if (!trace)
+        {
+            return;
+        }
+        pthread_setspecific(traceKey, trace);
+    }
+
+    trace->active = 1;
+    trace->start = MetricsNow();
+    trace->time = UtilTsMillis();
+    trace->total = 0;
+    trace->route = NULL;
+    trace->status = 0;
+    trace->nPhases = 0;
+    trace->nLocks = 0;
+    trace->locksDropped = 0;
+    trace->user[0] = '\0';
+
+    TraceCopy(trace->method, method, sizeof(trace->method));
+    TraceCopy(trace->path, path, sizeof(trace->path));
+}
+
+void
+TracePhase(char *name, uint64_t usec)
+{
+    Trace *trace = TraceCurrent();
+    size_t i;
+
+    if (!trace)
+    {
+        return;
+    }
+
+    for (i = 0; i < trace->nPhases; i++)
+    {
+        if (trace->phases[i].name == name)
+        {
+            trace->phases[i].usec += usec;
+            return;
+        }
+    }
+
+    if (trace->nPhases < TRACE_PHASES)
+    {
+        trace->phases[trace->nPhases].name = name;
+        trace->phases[trace->nPhases].usec = usec;
+        trace->nPhases++;
+    }
+}
+
+void
+TraceUser(char *user)
+{
+    Trace *trace = TraceCurrent();
+
+    if (trace)
+    {
+        TraceCopy(trace->user, user, sizeof(trace->user));
+    }
+}
+
+void
+TraceLockBegin(void)
+{
+    Trace *trace = TraceCurrent();
+
+    if (trace)
+    {
+        trace->lockStart = MetricsNow();
+    }
+}
+
+DbRef *
+TraceLockEnd(DbRef * ref, size_t nArgs,...)
+{
+    Trace *trace = TraceCurrent();
+    TraceLockRecord *record;
+    size_t len = 0;
+    va_list ap;
+    size_t i;
+
+    if (!trace)
+    {
+        return ref;
+    }
+
+    if (trace->nLocks >= TRACE_LOCKS)
+    {
+        trace->locksDropped++;
+        return ref;
+    }
+
+    record = &trace->locks[trace->nLocks++];
+    record->usec = MetricsNow() - trace->lockStart;
+    record->object[0] = '\0';
+
+    va_start(ap, nArgs);
+    for (i = 0; i < nArgs; i++)
+    {
+        char *part = va_arg(ap, char *);
+        int n = snprintf(record->object + len, sizeof(record->object) - len,
+                         "%s%s", i ? "/" : "", part ? part : "");
+
+        if (n < 0 || (size_t) n >= sizeof(record->object) - len)
+        {
+            break;
+        }
+        len += n;
+    }
+    va_end(ap);
+
+    return ref;
+}
+
+void
+TraceEnd(char *route, int status)
+{
+    Trace *trace = TraceCurrent();
+
+    if (!trace)
+    {
+        return;
+    }
+
+    trace->active = 0;
+    trace->total = MetricsNow() - trace->start;
+    trace->route = route;
+    trace->status = status;
+
+    if (trace->total < threshold)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&ringLock);
+    if (ring)
+    {
+        ring[ringNext] = *trace;
+        ringNext = (ringNext + 1) % TRACE_RING_SIZE;
+        if (ringCount < TRACE_RING_SIZE)
+        {
+            ringCount++;
+        }
+    }
+    pthread_mutex_unlock(&ringLock);
+}
+
+static JsonValue *
+TraceToJson(Trace * trace)
+{
+    HashMap *json = HashMapCreate();
+    HashMap *phases = HashMapCreate();
+    Array *locks = ArrayCreate();
+    size_t i;
+
+    for (i = 0; i < trace->nPhases; i++)
+    {
+        HashMapSet(phases, trace->phases[i].name,
+                   JsonValueInteger(trace->phases[i].usec));
+    }
+
+    for (i = 0; i < trace->nLocks; i++)
+    {
+        HashMap *lock = HashMapCreate();
+
+        HashMapSet(lock, "object", JsonValueString(trace->locks[i].object));
+        HashMapSet(lock, "wait_us", JsonValueInteger(trace->locks[i].usec));
+        ArrayAdd(locks, JsonValueObject(lock));
+    }
+
+    HashMapSet(json, "time", JsonValueInteger(trace->time));
+    HashMapSet(json, "method", JsonValueString(trace->method));
+    HashMapSet(json, "path", JsonValueString(trace->path));
+    HashMapSet(json, "route", trace->route ?
+               JsonValueString(trace->route) : JsonValueNull());
+    HashMapSet(json, "user", trace->user[0] ?
+               JsonValueString(trace->user) : JsonValueNull());
+    HashMapSet(json, "status", JsonValueInteger(trace->status));
+    HashMapSet(json, "total_us", JsonValueInteger(trace->total));
+    HashMapSet(json, "phases_us", JsonValueObject(phases));
+    HashMapSet(json, "locks", JsonValueArray(locks));
+    HashMapSet(json, "locks_dropped", JsonValueInteger(trace->locksDropped));
+
+    return JsonValueObject(json);
+}
+
+Array *
+TraceList(void)
+{
+    Array *list = ArrayCreate();
+    size_t i;
+
+    if (!list)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&ringLock);
+    for (i = 1; ring && i <= ringCount; i++)
+    {
+        Trace *trace = &ring[(ringNext + TRACE_RING_SIZE - i) % TRACE_RING_SIZE];
+
+        ArrayAdd(list, TraceToJson(trace));
+    }
+    pthread_mutex_unlock(&ringLock);
+
+    return list;
+}
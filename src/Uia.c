@@ -25,6 +25,8 @@
 #include <Uia.h>
 
 #include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 #include <RegToken.h>
 #include <Cytoplasm/Memory.h>
@@ -35,6 +37,10 @@
 
 #include <Matrix.h>
 #include <User.h>
+#include <Trace.h>
+
+#define UIA_SESSION_TIMEOUT (1000 * 60 * 15)
+#define UIA_CLEANUP_BATCH 64
 
 struct UiaStage
 {
@@ -42,6 +48,255 @@ struct UiaStage
     HashMap *params;
 };
 
+/*
+ * Sessions only live for a few minutes, so they are kept in memory
+ * rather than in the database. They are kept in a list ordered by last
+ * access, which makes the least recently used session the one to evict
+ * when the store is full, and puts expired sessions at the head where
+ * the cleanup job can find them without looking at the others.
+ */
+typedef struct UiaSession
+{
+    char *id;
+    HashMap *json;
+    uint64_t lastAccess;
+
+    pthread_mutex_t lock;
+    unsigned int refs;
+    int stored;
+
+    struct UiaSession *prev;
+    struct UiaSession *next;
+} UiaSession;
+
+static pthread_mutex_t storeLock = PTHREAD_MUTEX_INITIALIZER;
+static HashMap *store = NULL;
+static UiaSession *storeHead = NULL;
+static UiaSession *storeTail = NULL;
+static size_t storeCount = 0;
+static size_t storeMax = UIA_DEFAULT_MAX_SESSIONS;
+static int storePersist = 0;
+
+static void
+SessionFree(UiaSession * session)
+{
+    if (session)
+    {
+        Free(session->id);
+        JsonFree(session->json);
+        pthread_mutex_destroy(&session->lock);
+        Free(session);
+    }
+}
+
+static void
+SessionUnlink(UiaSession * session)
+{
+    if (session->prev)
+    {
+        session->prev->next = session->next;
+    }
+    else
+    {
+        storeHead = session->next;
+    }
+
+    if (session->next)
+    {
+        session->next->prev = session->prev;
+    }
+    else
+    {
+        storeTail = session->prev;
+    }
+
+    session->prev = NULL;
+    session->next = NULL;
+}
+
+static void
+SessionAppend(UiaSession * session)
+{
+    session->prev = storeTail;
+    if (storeTail)
+    {
+        storeTail->next = session;
+    }
+    else
+    {
+        storeHead = session;
+    }
+    storeTail = session;
+}
+
+/* Take a session out of the store. The store lock must be held. A
+ * session that a request is still using is freed when it is unlocked. */
+static void
+SessionRemove(UiaSession * session)
+{
+    SessionUnlink(session);
+    HashMapDelete(store, session->id);
+    session->stored = 0;
+    storeCount--;
+
+    if (!session->refs)
+    {
+        SessionFree(session);
+    }
+}
+
+/* Add a session to the back of the store, evicting the least recently
+ * used sessions if it is full. The store lock must be held. */
+static void
+SessionInsert(UiaSession * session)
+{
+    if (!store)
+    {
+        store = HashMapCreate();
+    }
+
+    while (storeCount >= storeMax && storeHead)
+    {
+        SessionRemove(storeHead);
+    }
+
+    HashMapSet(store, session->id, session);
+    SessionAppend(session);
+    session->stored = 1;
+    storeCount++;
+}
+
+static UiaSession *
+SessionAlloc(char *id, HashMap * json, uint64_t lastAccess)
+{
+    UiaSession *session = Malloc(sizeof(UiaSession));
+
+    if (!session)
+    {
+        return NULL;
+    }
+
+    session->id = id;
+    session->json = json;
+    session->lastAccess = lastAccess;
+    session->refs = 0;
+    session->stored = 0;
+    session->prev = NULL;
+    session->next = NULL;
+    pthread_mutex_init(&session->lock, NULL);
+
+    return session;
+}
+
+/* Create a new, empty session and return it locked. */
+static UiaSession *
+SessionCreate(void)
+{
+    UiaSession *session;
+    HashMap *json = HashMapCreate();
+    char *id;
+
+    if (!json)
+    {
+        return NULL;
+    }
+    HashMapSet(json, "completed", JsonValueArray(ArrayCreate()));
+
+    pthread_mutex_lock(&storeLock);
+    do
+    {
+        id = StrRandom(16);
+        if (!id)
+        {
+            pthread_mutex_unlock(&storeLock);
+            JsonFree(json);
+            return NULL;
+        }
+        if (store && HashMapGet(store, id))
+        {
+            Free(id);
+            id = NULL;
+        }
+    } while (!id);
+
+    session = SessionAlloc(id, json, UtilTsMillis());
+    if (!session)
+    {
+        pthread_mutex_unlock(&storeLock);
+        Free(id);
+        JsonFree(json);
+        return NULL;
+    }
+
+    session->refs++;
+    SessionInsert(session);
+    pthread_mutex_lock(&session->lock);
+    pthread_mutex_unlock(&storeLock);
+
+    return session;
+}
+
+/* Find an unexpired session and lock it, so that concurrent requests
+ * in the same session are handled one at a time. */
+static UiaSession *
+SessionLock(char *id)
+{
+    UiaSession *session;
+
+    if (!id)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&storeLock);
+    session = store ? HashMapGet(store, id) : NULL;
+    if (session && session->lastAccess + UIA_SESSION_TIMEOUT < UtilTsMillis())
+    {
+        SessionRemove(session);
+        session = NULL;
+    }
+    if (session)
+    {
+        session->refs++;
+    }
+    pthread_mutex_unlock(&storeLock);
+
+    if (!session)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&session->lock);
+    return session;
+}
+
+/* Unlock a session, recording the access if requested. */
+static void
+SessionUnlock(UiaSession * session, int touch)
+{
+    if (!session)
+    {
+        return;
+    }
+
+    pthread_mutex_unlock(&session->lock);
+
+    pthread_mutex_lock(&storeLock);
+    if (session->stored && touch)
+    {
+        session->lastAccess = UtilTsMillis();
+        SessionUnlink(session);
+        SessionAppend(session);
+    }
+
+    session->refs--;
+    if (!session->stored && !session->refs)
+    {
+        SessionFree(session);
+    }
+    pthread_mutex_unlock(&storeLock);
+}
+
 static HashMap *
 BuildFlows(Array * flows)
 {
@@ -105,9 +360,12 @@ BuildFlows(Array * flows)
 }
 
 static int
-BuildResponse(Array * flows, Db * db, HashMap ** response, char *session, DbRef * ref)
+BuildResponse(Array * flows, HashMap ** response, UiaSession * session)
 {
-    HashMap *json;
+    Array *completed;
+    Array *sessionCompleted;
+    size_t i;
+    int created = 0;
 
     *response = BuildFlows(flows);
 
@@ -118,58 +376,42 @@ BuildResponse(Array * flows, Db * db, HashMap ** response, char *session, DbRef
 
     if (!session)
     {
-        session = StrRandom(16);
+        session = SessionCreate();
         if (!session)
         {
             JsonFree(*response);
             return -1;
         }
-
-        ref = DbCreate(db, 2, "user_interactive", session);
-        if (!ref)
-        {
-            Free(session);
-            JsonFree(*response);
-            return -1;
-        }
-
-        json = DbJson(ref);
-        HashMapSet(json, "completed", JsonValueArray(ArrayCreate()));
-        HashMapSet(json, "last_access", JsonValueInteger(UtilTsMillis()));
-        DbUnlock(db, ref);
-
-        HashMapSet(*response, "completed", JsonValueArray(ArrayCreate()));
+        created = 1;
     }
-    else
-    {
-        Array *completed = ArrayCreate();
-        Array *dbCompleted;
-        size_t i;
 
-        if (!completed)
+    completed = ArrayCreate();
+    if (!completed)
+    {
+        if (created)
         {
-            JsonFree(*response);
-            return -1;
+            SessionUnlock(session, 0);
         }
+        JsonFree(*response);
+        return -1;
+    }
 
-        json = DbJson(ref);
-        dbCompleted = JsonValueAsArray(HashMapGet(json, "completed"));
-
-        for (i = 0; i < ArraySize(dbCompleted); i++)
-        {
-            char *stage = JsonValueAsString(ArrayGet(dbCompleted, i));
+    sessionCompleted = JsonValueAsArray(HashMapGet(session->json, "completed"));
+    for (i = 0; i < ArraySize(sessionCompleted); i++)
+    {
+        char *stage = JsonValueAsString(ArrayGet(sessionCompleted, i));
 
-            ArrayAdd(completed, JsonValueString(stage));
-        }
+        ArrayAdd(completed, JsonValueString(stage));
+    }
 
-        HashMapSet(*response, "completed", JsonValueArray(completed));
+    HashMapSet(*response, "completed", JsonValueArray(completed));
+    HashMapSet(*response, "session", JsonValueString(session->id));
 
-        session = StrDuplicate(session);
+    if (created)
+    {
+        SessionUnlock(session, 0);
     }
 
-    HashMapSet(*response, "session", JsonValueString(session));
-    Free(session);
-
     return 0;
 }
 
@@ -206,7 +448,7 @@ UiaStageBuild(char *type, HashMap * params)
 
 int
 UiaComplete(Array * flows, HttpServerContext * context, Db * db,
-            HashMap * request, HashMap ** response, Config config)
+            HashMap * request, HashMap ** response, Config * config)
 {
     JsonValue *val;
     HashMap *auth;
@@ -219,8 +461,8 @@ UiaComplete(Array * flows, HttpServerContext * context, Db * db,
                                     * right? */
     size_t i;
 
-    DbRef *dbRef;
-    HashMap *dbJson;
+    UiaSession *uiaSession;
+    HashMap *sessionJson;
     int ret;
 
     char *msg;
@@ -240,7 +482,7 @@ UiaComplete(Array * flows, HttpServerContext * context, Db * db,
     if (!val)
     {
         HttpResponseStatus(context, HTTP_UNAUTHORIZED);
-        return BuildResponse(flows, db, response, NULL, NULL);
+        return BuildResponse(flows, response, NULL);
     }
 
     if (JsonValueType(val) != JSON_OBJECT)
@@ -264,16 +506,16 @@ UiaComplete(Array * flows, HttpServerContext * context, Db * db,
 
     session = JsonValueAsString(val);
 
-    dbRef = DbLock(db, 2, "user_interactive", session);
-    if (!dbRef)
+    uiaSession = SessionLock(session);
+    if (!uiaSession)
     {
         HttpResponseStatus(context, HTTP_UNAUTHORIZED);
-        return BuildResponse(flows, db, response, NULL, NULL);
+        return BuildResponse(flows, response, NULL);
     }
 
-    dbJson = DbJson(dbRef);
+    sessionJson = uiaSession->json;
 
-    completed = JsonValueAsArray(HashMapGet(dbJson, "completed"));
+    completed = JsonValueAsArray(HashMapGet(sessionJson, "completed"));
     possibleNext = ArrayCreate();
 
     for (i = 0; i < ArraySize(flows); i++)
@@ -338,7 +580,7 @@ UiaComplete(Array * flows, HttpServerContext * context, Db * db,
     if (i == ArraySize(possibleNext))
     {
         HttpResponseStatus(context, HTTP_UNAUTHORIZED);
-        ret = BuildResponse(flows, db, response, session, dbRef);
+        ret = BuildResponse(flows, response, uiaSession);
         goto finish;
     }
 
@@ -357,20 +599,20 @@ UiaComplete(Array * flows, HttpServerContext * context, Db * db,
         if (!password || !identifier)
         {
             HttpResponseStatus(context, HTTP_UNAUTHORIZED);
-            ret = BuildResponse(flows, db, response, session, dbRef);
+            ret = BuildResponse(flows, response, uiaSession);
             goto finish;
         }
 
         type = JsonValueAsString(HashMapGet(identifier, "type"));
         userId = UserIdParse(JsonValueAsString(HashMapGet(identifier, "user")),
-                             config.serverName);
+                             config->serverName);
 
         if (!type || !StrEquals(type, "m.id.user")
          || !userId
-         || !ParserServerNameEquals(userId->server, config.serverName))
+         || !ParserServerNameEquals(userId->server, config->serverName))
         {
             HttpResponseStatus(context, HTTP_UNAUTHORIZED);
-            ret = BuildResponse(flows, db, response, session, dbRef);
+            ret = BuildResponse(flows, response, uiaSession);
             UserIdFree(userId);
             goto finish;
         }
@@ -379,7 +621,7 @@ UiaComplete(Array * flows, HttpServerContext * context, Db * db,
         if (!user)
         {
             HttpResponseStatus(context, HTTP_UNAUTHORIZED);
-            ret = BuildResponse(flows, db, response, session, dbRef);
+            ret = BuildResponse(flows, response, uiaSession);
             UserIdFree(userId);
             goto finish;
         }
@@ -387,7 +629,7 @@ UiaComplete(Array * flows, HttpServerContext * context, Db * db,
         if (!UserCheckPassword(user, password))
         {
             HttpResponseStatus(context, HTTP_UNAUTHORIZED);
-            ret = BuildResponse(flows, db, response, session, dbRef);
+            ret = BuildResponse(flows, response, uiaSession);
             UserIdFree(userId);
             UserUnlock(user);
             goto finish;
@@ -405,7 +647,7 @@ UiaComplete(Array * flows, HttpServerContext * context, Db * db,
         if (!RegTokenExists(db, token))
         {
             HttpResponseStatus(context, HTTP_UNAUTHORIZED);
-            ret = BuildResponse(flows, db, response, session, dbRef);
+            ret = BuildResponse(flows, response, uiaSession);
             goto finish;
         }
         tokenInfo = RegTokenGetInfo(db, token);
@@ -415,7 +657,7 @@ UiaComplete(Array * flows, HttpServerContext * context, Db * db,
             RegTokenFree(tokenInfo);
 
             HttpResponseStatus(context, HTTP_UNAUTHORIZED);
-            ret = BuildResponse(flows, db, response, session, dbRef);
+            ret = BuildResponse(flows, response, uiaSession);
             goto finish;
         }
         /* Use the token, and then close it. */
@@ -428,14 +670,14 @@ UiaComplete(Array * flows, HttpServerContext * context, Db * db,
          * the registration endpoint will have to extract the proper
          * privileges to set on the user based on the token.
          */
-        JsonValueFree(HashMapSet(dbJson, "registration_token", JsonValueString(token)));
+        JsonValueFree(HashMapSet(sessionJson, "registration_token", JsonValueString(token)));
     }
     /* TODO: implement m.login.recaptcha, m.login.sso,
      * m.login.email.identity, m.login.msisdn here */
     else
     {
         HttpResponseStatus(context, HTTP_UNAUTHORIZED);
-        ret = BuildResponse(flows, db, response, session, dbRef);
+        ret = BuildResponse(flows, response, uiaSession);
         goto finish;
     }
 
@@ -444,7 +686,7 @@ UiaComplete(Array * flows, HttpServerContext * context, Db * db,
     if (remaining[i] - 1 > 0)
     {
         HttpResponseStatus(context, HTTP_UNAUTHORIZED);
-        ret = BuildResponse(flows, db, response, session, dbRef);
+        ret = BuildResponse(flows, response, uiaSession);
         goto finish;
     }
 
@@ -452,8 +694,7 @@ UiaComplete(Array * flows, HttpServerContext * context, Db * db,
 
 finish:
     ArrayFree(possibleNext);
-    JsonValueFree(HashMapSet(dbJson, "last_access", JsonValueInteger(UtilTsMillis())));
-    DbUnlock(db, dbRef);
+    SessionUnlock(uiaSession, 1);
     return ret;
 }
 
@@ -488,37 +729,192 @@ UiaFlowsFree(Array * flows)
 void
 UiaCleanup(MatrixHttpHandlerArgs * args)
 {
-    Array *sessions = DbList(args->db, 1, "user_interactive");
+    uint64_t now;
+    size_t removed = 0;
+    size_t count;
+
+    (void) args;
+
+    /* Remove expired sessions a few at a time, so that requests never
+     * wait long on the store. */
+    do
+    {
+        count = 0;
+
+        /*
+         * Sessions may have been touched since the last batch, so get
+         * the time again. Compare without subtracting, so that a
+         * session touched after now was read can't look expired.
+         */
+        pthread_mutex_lock(&storeLock);
+        now = UtilTsMillis();
+        while (count < UIA_CLEANUP_BATCH && storeHead &&
+               storeHead->lastAccess + UIA_SESSION_TIMEOUT < now)
+        {
+            SessionRemove(storeHead);
+            count++;
+        }
+        pthread_mutex_unlock(&storeLock);
+
+        removed += count;
+    } while (count == UIA_CLEANUP_BATCH);
+
+    pthread_mutex_lock(&storeLock);
+    Log(LOG_DEBUG, "User Interactive Auth sessions: %lu (%lu expired)",
+        storeCount, removed);
+    pthread_mutex_unlock(&storeLock);
+}
+
+static int
+SessionCompare(const void *a, const void *b)
+{
+    const UiaSession *x = *(UiaSession * const *) a;
+    const UiaSession *y = *(UiaSession * const *) b;
+
+    return (x->lastAccess > y->lastAccess) - (x->lastAccess < y->lastAccess);
+}
+
+void
+UiaInit(Db * db, size_t max, int persist)
+{
+    Array *ids;
+    UiaSession **loaded;
+    size_t count = 0;
+    uint64_t now = UtilTsMillis();
     size_t i;
 
-    Log(LOG_DEBUG, "User Interactive Auth sessions: %lu",
-        ArraySize(sessions));
-    for (i = 0; i < ArraySize(sessions); i++)
+    pthread_mutex_lock(&storeLock);
+    storeMax = max ? max : UIA_DEFAULT_MAX_SESSIONS;
+    storePersist = persist;
+    if (!store)
     {
-        char *session = ArrayGet(sessions, i);
-        DbRef *ref = DbLock(args->db, 2, "user_interactive", session);
+        store = HashMapCreate();
+    }
+    pthread_mutex_unlock(&storeLock);
 
+    if (!db)
+    {
+        return;
+    }
+
+    /* Pick up the sessions saved at the last shutdown, or left behind
+     * by a version that kept sessions in the database, and remove them
+     * from disk. */
+    ids = DbList(db, 1, "user_interactive");
+    loaded = Malloc(sizeof(UiaSession *) * (ArraySize(ids) + 1));
+    if (!loaded)
+    {
+        DbListFree(ids);
+        return;
+    }
+
+    for (i = 0; i < ArraySize(ids); i++)
+    {
+        char *id = ArrayGet(ids, i);
+        DbRef *ref = TraceDbLock(db, 2, "user_interactive", id);
+        UiaSession *session;
+        HashMap *json;
         uint64_t lastAccess;
 
         if (!ref)
         {
-            Log(LOG_ERR, "Unable to lock uia %s for inspection.",
-                session);
             continue;
         }
 
-        lastAccess = JsonValueAsInteger(HashMapGet(DbJson(ref), "last_access"));
+        json = JsonDuplicate(DbJson(ref));
+        DbUnlock(db, ref);
+        DbDelete(db, 2, "user_interactive", id);
+
+        lastAccess = JsonValueAsInteger(HashMapGet(json, "last_access"));
+        JsonValueFree(HashMapDelete(json, "last_access"));
+
+        if (lastAccess + UIA_SESSION_TIMEOUT < now)
+        {
+            JsonFree(json);
+            continue;
+        }
+
+        session = SessionAlloc(StrDuplicate(id), json, lastAccess);
+        if (!session)
+        {
+            JsonFree(json);
+            continue;
+        }
+
+        loaded[count++] = session;
+    }
+    DbListFree(ids);
+
+    qsort(loaded, count, sizeof(UiaSession *), SessionCompare);
+
+    pthread_mutex_lock(&storeLock);
+    for (i = 0; i < count; i++)
+    {
+        SessionInsert(loaded[i]);
+    }
+    pthread_mutex_unlock(&storeLock);
+
+    Free(loaded);
+
+    if (count)
+    {
+        Log(LOG_NOTICE, "Restored %lu user interactive auth sessions.", count);
+    }
+}
 
-        DbUnlock(args->db, ref);
+void
+UiaFree(Db * db)
+{
+    size_t saved = 0;
+
+    pthread_mutex_lock(&storeLock);
+    while (storeHead)
+    {
+        UiaSession *session = storeHead;
 
-        /* If last access was greater than 15 minutes ago, remove this
-         * session */
-        if ((UtilTsMillis() - lastAccess) > (1000 * 60 * 15))
+        if (storePersist && db)
         {
-            DbDelete(args->db, 2, "user_interactive", session);
-            Log(LOG_DEBUG, "Deleted session %s", session);
+            DbRef *ref = DbCreate(db, 2, "user_interactive", session->id);
+
+            if (ref)
+            {
+                HashMapSet(session->json, "last_access",
+                           JsonValueInteger(session->lastAccess));
+                DbJsonSet(ref, session->json);
+                DbUnlock(db, ref);
+                saved++;
+            }
         }
+
+        SessionRemove(session);
+    }
+
+    if (store)
+    {
+        HashMapFree(store);
+        store = NULL;
+    }
+    pthread_mutex_unlock(&storeLock);
+
+    if (saved)
+    {
+        Log(LOG_NOTICE, "Saved %lu user interactive auth sessions.", saved);
     }
+}
+
+char *
+UiaSessionGet(char *id, char *key)
+{
+    UiaSession *session = SessionLock(id);
+    char *val;
+
+    if (!session)
+    {
+        return NULL;
+    }
+
+    val = StrDuplicate(JsonValueAsString(HashMapGet(session->json, key)));
+    SessionUnlock(session, 0);
 
-    DbListFree(sessions);
+    return val;
 }
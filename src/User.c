@@ -30,18 +30,108 @@
 #include <Cytoplasm/Json.h>
 
 #include <Parser.h>
+#include <TokenCache.h>
+#include <SignedToken.h>
+#include <TokenExpiry.h>
+#include <UserIndex.h>
+#include <Trace.h>
 
+#include <pthread.h>
 #include <string.h>
 
+/* The number of idle lock entries, and thus cached snapshots, to keep
+ * around before they are freed as soon as they become idle. */
+#define USER_LOCK_CACHE_MAX 1024
+
+/*
+ * The database only offers exclusive locks, so users get a
+ * reader-writer lock of their own on top of it. Readers share a
+ * read-only copy of the user object, which writers throw away when
+ * they unlock.
+ */
+typedef struct UserLockEntry
+{
+    pthread_rwlock_t lock;
+
+    pthread_mutex_t fill;
+    HashMap *snapshot;
+
+    /* The number of handles holding or waiting on this entry */
+    unsigned long refs;
+} UserLockEntry;
+
 struct User
 {
     Db *db;
     DbRef *ref;
+    HashMap *json;
+
+    UserLockEntry *lock;
+    bool readOnly;
 
     char *name;
     char *deviceId;
+
+    /* Decoded privileges, or -1 if they haven't been decoded yet. */
+    int privileges;
 };
 
+static pthread_mutex_t lockTableMutex = PTHREAD_MUTEX_INITIALIZER;
+static HashMap *lockTable = NULL;
+static size_t lockTableSize = 0;
+
+static UserLockEntry *
+LockEntryAcquire(char *name)
+{
+    UserLockEntry *entry;
+
+    pthread_mutex_lock(&lockTableMutex);
+    if (!lockTable)
+    {
+        lockTable = HashMapCreate();
+    }
+
+    entry = HashMapGet(lockTable, name);
+    if (!entry)
+    {
+        entry = Malloc(sizeof(UserLockEntry));
+        pthread_rwlock_init(&entry->lock, NULL);
+        pthread_mutex_init(&entry->fill, NULL);
+        entry->snapshot = NULL;
+        entry->refs = 0;
+
+        HashMapSet(lockTable, name, entry);
+        lockTableSize++;
+    }
+    entry->refs++;
+    pthread_mutex_unlock(&lockTableMutex);
+
+    return entry;
+}
+
+static void
+LockEntryFree(UserLockEntry * entry)
+{
+    JsonFree(entry->snapshot);
+    pthread_mutex_destroy(&entry->fill);
+    pthread_rwlock_destroy(&entry->lock);
+    Free(entry);
+}
+
+static void
+LockEntryRelease(char *name, UserLockEntry * entry)
+{
+    pthread_mutex_lock(&lockTableMutex);
+    entry->refs--;
+    if (!entry->refs && lockTableSize > USER_LOCK_CACHE_MAX)
+    {
+        HashMapDelete(lockTable, name);
+        lockTableSize--;
+        LockEntryFree(entry);
+    }
+    pthread_mutex_unlock(&lockTableMutex);
+}
+
 bool
 UserValidate(char *localpart, char *domain)
 {
@@ -107,86 +197,242 @@ UserLock(Db * db, char *name)
 {
     User *user = NULL;
     DbRef *ref = NULL;
+    UserLockEntry *entry;
 
     if (!UserExists(db, name))
     {
         return NULL;
     }
 
-    ref = DbLock(db, 2, "users", name);
+    entry = LockEntryAcquire(name);
+    pthread_rwlock_wrlock(&entry->lock);
+
+    ref = TraceDbLock(db, 2, "users", name);
+    if (!ref)
+    {
+        pthread_rwlock_unlock(&entry->lock);
+        LockEntryRelease(name, entry);
+        return NULL;
+    }
+
     user = Malloc(sizeof(User));
     user->db = db;
     user->ref = ref;
+    user->json = DbJson(ref);
+    user->lock = entry;
+    user->readOnly = false;
     user->name = StrDuplicate(name);
     user->deviceId = NULL;
+    user->privileges = -1;
 
     return user;
 }
 
 User *
-UserAuthenticate(Db * db, char *accessToken)
+UserLockShared(Db * db, char *name)
+{
+    User *user = NULL;
+    UserLockEntry *entry;
+
+    if (!UserExists(db, name))
+    {
+        return NULL;
+    }
+
+    entry = LockEntryAcquire(name);
+    pthread_rwlock_rdlock(&entry->lock);
+
+    /* Writers are locked out, so only other readers can race to fill
+     * in the snapshot. */
+    pthread_mutex_lock(&entry->fill);
+    if (!entry->snapshot)
+    {
+        DbRef *ref = TraceDbLock(db, 2, "users", name);
+
+        if (ref)
+        {
+            entry->snapshot = JsonDuplicate(DbJson(ref));
+            DbUnlock(db, ref);
+        }
+    }
+    pthread_mutex_unlock(&entry->fill);
+
+    if (!entry->snapshot)
+    {
+        pthread_rwlock_unlock(&entry->lock);
+        LockEntryRelease(name, entry);
+        return NULL;
+    }
+
+    user = Malloc(sizeof(User));
+    user->db = db;
+    user->ref = NULL;
+    user->json = entry->snapshot;
+    user->lock = entry;
+    user->readOnly = true;
+    user->name = StrDuplicate(name);
+    user->deviceId = NULL;
+    user->privileges = -1;
+
+    return user;
+}
+
+static User *
+Authenticate(Db * db, char *accessToken, bool shared)
 {
     User *user;
     DbRef *atRef;
-
-    char *userName;
-    char *deviceId;
-    uint64_t expires;
+    TokenCacheInfo info;
+    TokenCacheResult cached;
 
     if (!db || !accessToken)
     {
         return NULL;
     }
 
-    atRef = DbLock(db, 3, "tokens", "access", accessToken);
-    if (!atRef)
+    if (SignedTokenIs(accessToken))
     {
-        return NULL;
+        /* Signed tokens are verified without touching the database,
+         * so there's nothing to gain from caching them. The user is
+         * still locked below, since the caller gets a reference to
+         * it; UserAccessTokenInfo() only verifies the token. */
+        if (!SignedTokenVerify(accessToken, &info.user, &info.deviceId, &info.expires))
+        {
+            return NULL;
+        }
+
+        info.privileges = -1;
+        cached = TOKEN_CACHE_HIT;
+    }
+    else
+    {
+        cached = TokenCacheGet(accessToken, &info);
     }
 
-    userName = JsonValueAsString(HashMapGet(DbJson(atRef), "user"));
-    deviceId = JsonValueAsString(HashMapGet(DbJson(atRef), "device"));
-    expires =  JsonValueAsInteger(HashMapGet(DbJson(atRef), "expires"));
+    if (cached == TOKEN_CACHE_UNKNOWN)
+    {
+        return NULL;
+    }
 
-    user = UserLock(db, userName);
-    if (!user)
+    if (cached == TOKEN_CACHE_MISS)
     {
+        atRef = TraceDbLock(db, 3, "tokens", "access", accessToken);
+        if (!atRef)
+        {
+            TokenCachePutUnknown(accessToken);
+            return NULL;
+        }
+
+        info.user = StrDuplicate(JsonValueAsString(HashMapGet(DbJson(atRef), "user")));
+        info.deviceId = StrDuplicate(JsonValueAsString(HashMapGet(DbJson(atRef), "device")));
+        info.expires = JsonValueAsInteger(HashMapGet(DbJson(atRef), "expires"));
+        info.privileges = -1;
+
         DbUnlock(db, atRef);
+    }
+
+    if (info.expires && UtilTsMillis() >= info.expires)
+    {
+        TokenCacheInfoFree(&info);
         return NULL;
     }
 
-    if (expires && UtilTsMillis() >= expires)
+    user = shared ? UserLockShared(db, info.user) : UserLock(db, info.user);
+    if (!user)
     {
-        UserUnlock(user);
-        DbUnlock(db, atRef);
+        TokenCacheInfoFree(&info);
         return NULL;
     }
 
-    user->deviceId = StrDuplicate(deviceId);
+    if (cached == TOKEN_CACHE_MISS)
+    {
+        /*
+         * Tokens are only ever deleted with the user locked, so now
+         * that we hold the lock, make sure the token wasn't deleted
+         * after we read it, otherwise we'd cache a dead token.
+         */
+        if (!DbExists(db, 3, "tokens", "access", accessToken))
+        {
+            UserUnlock(user);
+            TokenCacheInfoFree(&info);
+            return NULL;
+        }
+
+        info.privileges = UserGetPrivileges(user);
+        TokenCachePut(accessToken, &info);
+    }
+
+    TraceUser(info.user);
 
-    DbUnlock(db, atRef);
+    user->privileges = info.privileges;
+    user->deviceId = info.deviceId;
+    info.deviceId = NULL;
+
+    TokenCacheInfoFree(&info);
     return user;
 }
 
+User *
+UserAuthenticate(Db * db, char *accessToken)
+{
+    return Authenticate(db, accessToken, false);
+}
+
+User *
+UserAuthenticateShared(Db * db, char *accessToken)
+{
+    return Authenticate(db, accessToken, true);
+}
+
 bool
 UserUnlock(User * user)
 {
-    bool ret;
+    bool ret = true;
 
     if (!user)
     {
         return false;
     }
 
+    if (!user->readOnly)
+    {
+        /* Readers must not see the old object anymore. */
+        JsonFree(user->lock->snapshot);
+        user->lock->snapshot = NULL;
+
+        ret = DbUnlock(user->db, user->ref);
+    }
+
+    pthread_rwlock_unlock(&user->lock->lock);
+    LockEntryRelease(user->name, user->lock);
+
     Free(user->name);
     Free(user->deviceId);
-
-    ret = DbUnlock(user->db, user->ref);
     Free(user);
 
     return ret;
 }
 
+void
+UserLockTableFree(void)
+{
+    char *name;
+    void *entry;
+
+    pthread_mutex_lock(&lockTableMutex);
+    if (lockTable)
+    {
+        while (HashMapIterate(lockTable, &name, &entry))
+        {
+            LockEntryFree(entry);
+        }
+        HashMapFree(lockTable);
+        lockTable = NULL;
+        lockTableSize = 0;
+    }
+    pthread_mutex_unlock(&lockTableMutex);
+}
+
 User *
 UserCreate(Db * db, char *name, char *password)
 {
@@ -206,6 +452,9 @@ UserCreate(Db * db, char *name, char *password)
 
     user = Malloc(sizeof(User));
     user->db = db;
+    user->deviceId = NULL;
+    user->privileges = -1;
+    user->readOnly = false;
 
     if (!name)
     {
@@ -216,22 +465,30 @@ UserCreate(Db * db, char *name, char *password)
         user->name = StrDuplicate(name);
     }
 
+    user->lock = LockEntryAcquire(user->name);
+    pthread_rwlock_wrlock(&user->lock->lock);
+
     user->ref = DbCreate(db, 2, "users", user->name);
     if (!user->ref)
     {
         /* The only scenario where I can see that occur is if for some
          * strange reason, Db fails to create a file(e.g fs is full) */
+        pthread_rwlock_unlock(&user->lock->lock);
+        LockEntryRelease(user->name, user->lock);
         Free(user->name);
         Free(user);
         return NULL;
     }
+    user->json = DbJson(user->ref);
 
     UserSetPassword(user, password);
 
-    json = DbJson(user->ref);
+    json = user->json;
     HashMapSet(json, "createdOn", JsonValueInteger(ts));
     HashMapSet(json, "deactivated", JsonValueBoolean(false));
 
+    UserIndexPut(user->name, NULL, NULL);
+
     return user;
 }
 
@@ -246,7 +503,7 @@ UserLogin(User * user, char *password, char *deviceId, char *deviceDisplayName,
 
     UserLoginInfo *result;
 
-    if (!user || !password)
+    if (!user || user->readOnly || !password)
     {
         return NULL;
     }
@@ -287,11 +544,11 @@ UserLogin(User * user, char *password, char *deviceId, char *deviceDisplayName,
         DbUnlock(user->db, rtRef);
     }
 
-    devices = JsonValueAsObject(HashMapGet(DbJson(user->ref), "devices"));
+    devices = JsonValueAsObject(HashMapGet(user->json, "devices"));
     if (!devices)
     {
         devices = HashMapCreate();
-        HashMapSet(DbJson(user->ref), "devices", JsonValueObject(devices));
+        HashMapSet(user->json, "devices", JsonValueObject(devices));
     }
 
     device = JsonValueAsObject(HashMapGet(devices, deviceId));
@@ -303,7 +560,7 @@ UserLogin(User * user, char *password, char *deviceId, char *deviceDisplayName,
         val = HashMapDelete(device, "accessToken");
         if (val)
         {
-            DbDelete(user->db, 3, "tokens", "access", JsonValueAsString(val));
+            UserAccessTokenDelete(user->db, JsonValueAsString(val));
             JsonValueFree(val);
         }
 
@@ -372,7 +629,7 @@ UserCheckPassword(User * user, char *password)
         return false;
     }
 
-    json = DbJson(user->ref);
+    json = user->json;
 
     storedHash = JsonValueAsString(HashMapGet(json, "password"));
     salt = JsonValueAsString(HashMapGet(json, "salt"));
@@ -405,12 +662,12 @@ UserSetPassword(User * user, char *password)
     char *salt = NULL;
     char *tmpstr = NULL;
 
-    if (!user || !password)
+    if (!user || user->readOnly || !password)
     {
         return false;
     }
 
-    json = DbJson(user->ref);
+    json = user->json;
 
     salt = StrRandom(16);
     tmpstr = StrConcat(2, password, salt);
@@ -434,7 +691,7 @@ UserDeactivate(User * user, char * from, char * reason)
     HashMap *json;
     JsonValue *val;
 
-    if (!user)
+    if (!user || user->readOnly)
     {
         return false;
     }
@@ -445,9 +702,11 @@ UserDeactivate(User * user, char * from, char * reason)
         from = UserGetName(user);
     }
 
-    json = DbJson(user->ref);
+    json = user->json;
 
     JsonValueFree(HashMapSet(json, "deactivated", JsonValueBoolean(true)));
+    TokenCacheInvalidateUser(UserGetName(user));
+    UserIndexRemove(UserGetName(user));
 
     val = JsonValueString(from);
     JsonValueFree(JsonSet(json, val, 2, "deactivate", "by"));
@@ -466,18 +725,21 @@ UserReactivate(User * user)
 {
     HashMap *json;
 
-    if (!user)
+    if (!user || user->readOnly)
     {
         return false;
     }
 
-    json = DbJson(user->ref);
+    json = user->json;
 
 
     JsonValueFree(HashMapSet(json, "deactivated", JsonValueBoolean(false)));
     
     JsonValueFree(HashMapDelete(json, "deactivate"));
 
+    UserIndexPut(UserGetName(user), UserGetProfile(user, "displayname"),
+                 UserGetProfile(user, "avatar_url"));
+
     return true;
 }
 
@@ -491,7 +753,7 @@ UserDeactivated(User * user)
         return true;
     }
 
-    json = DbJson(user->ref);
+    json = user->json;
 
     return JsonValueAsBoolean(HashMapGet(json, "deactivated"));
 }
@@ -506,7 +768,7 @@ UserGetDevices(User * user)
         return NULL;
     }
 
-    json = DbJson(user->ref);
+    json = user->json;
 
     return JsonValueAsObject(HashMapGet(json, "devices"));
 }
@@ -530,8 +792,6 @@ UserAccessTokenGenerate(User * user, char *deviceId, int withRefresh)
     token->user = StrDuplicate(user->name);
     token->deviceId = StrDuplicate(deviceId);
 
-    token->string = StrRandom(64);
-
     if (withRefresh)
     {
         token->lifetime = 1000 * 60 * 60 * 24 * 7; /* 1 Week */
@@ -541,6 +801,24 @@ UserAccessTokenGenerate(User * user, char *deviceId, int withRefresh)
         token->lifetime = 0;
     }
 
+    /*
+     * Only tokens that expire are signed. A revoked signed token has
+     * to be remembered until it expires, so a token that never did
+     * would be remembered forever.
+     */
+    token->string = NULL;
+    if (SignedTokenEnabled() && token->lifetime)
+    {
+        uint64_t expires = UtilTsMillis() + token->lifetime;
+
+        token->string = SignedTokenCreate(user->name, deviceId, expires);
+    }
+
+    if (!token->string)
+    {
+        token->string = StrRandom(64);
+    }
+
     return token;
 }
 
@@ -549,12 +827,25 @@ UserAccessTokenSave(Db * db, UserAccessToken * token)
 {
     DbRef *ref;
     HashMap *json;
+    uint64_t expires;
 
     if (!token)
     {
         return false;
     }
 
+    expires = token->lifetime ? UtilTsMillis() + token->lifetime : 0;
+    if (expires)
+    {
+        TokenExpiryAdd(db, token->string, token->user, expires);
+    }
+
+    /* Signed tokens carry everything they need. */
+    if (SignedTokenIs(token->string))
+    {
+        return true;
+    }
+
     ref = DbCreate(db, 3, "tokens", "access", token->string);
 
     if (!ref)
@@ -567,14 +858,67 @@ UserAccessTokenSave(Db * db, UserAccessToken * token)
     HashMapSet(json, "user", JsonValueString(token->user));
     HashMapSet(json, "device", JsonValueString(token->deviceId));
 
-    if (token->lifetime)
+    if (expires)
     {
-        HashMapSet(json, "expires", JsonValueInteger(UtilTsMillis() + token->lifetime));
+        HashMapSet(json, "expires", JsonValueInteger(expires));
     }
 
+    /* Forget any negative entry left over from an earlier lookup. */
+    TokenCacheInvalidate(token->string);
+
     return DbUnlock(db, ref);
 }
 
+bool
+UserAccessTokenDelete(Db * db, char *token)
+{
+    bool ret;
+
+    if (!db || !token)
+    {
+        return false;
+    }
+
+    if (SignedTokenIs(token))
+    {
+        return SignedTokenRevoke(token);
+    }
+
+    ret = DbDelete(db, 3, "tokens", "access", token);
+    TokenCacheInvalidate(token);
+
+    return ret;
+}
+
+bool
+UserAccessTokenInfo(Db * db, char *token, char **user, char **deviceId)
+{
+    DbRef *ref;
+    uint64_t expires;
+
+    if (!db || !token || !user || !deviceId)
+    {
+        return false;
+    }
+
+    if (SignedTokenIs(token))
+    {
+        return SignedTokenVerify(token, user, deviceId, &expires);
+    }
+
+    ref = TraceDbLock(db, 3, "tokens", "access", token);
+    if (!ref)
+    {
+        return false;
+    }
+
+    *user = StrDuplicate(JsonValueAsString(HashMapGet(DbJson(ref), "user")));
+    *deviceId = StrDuplicate(JsonValueAsString(HashMapGet(DbJson(ref), "device")));
+
+    DbUnlock(db, ref);
+    return true;
+}
+
 void
 UserAccessTokenFree(UserAccessToken * token)
 {
@@ -592,79 +936,63 @@ UserAccessTokenFree(UserAccessToken * token)
 bool
 UserDeleteToken(User * user, char *token)
 {
-    char *username;
-    char *deviceId;
+    char *username = NULL;
+    char *deviceId = NULL;
     char *refreshToken;
 
-    Db *db;
-    DbRef *tokenRef;
-
-    HashMap *tokenJson;
     HashMap *userJson;
     HashMap *deviceObj;
 
     JsonValue *deletedVal;
+    bool ret = false;
 
-    if (!user || !token)
-    {
-        return false;
-    }
-
-    db = user->db;
-    /* First check if the token even exists */
-    if (!DbExists(db, 3, "tokens", "access", token))
+    if (!user || user->readOnly || !token)
     {
         return false;
     }
 
-    /* If it does, get it's username. */
-    tokenRef = DbLock(db, 3, "tokens", "access", token);
-
-    if (!tokenRef)
+    /* Get the token's username and device, if it even exists. */
+    if (!UserAccessTokenInfo(user->db, token, &username, &deviceId))
     {
         return false;
     }
-    tokenJson = DbJson(tokenRef);
-    username = JsonValueAsString(HashMapGet(tokenJson, "user"));
-    deviceId = JsonValueAsString(HashMapGet(tokenJson, "device"));
 
     if (!StrEquals(username, UserGetName(user)))
     {
         /* Token does not match user, do not delete it */
-        DbUnlock(db, tokenRef);
-        return false;
+        goto finish;
     }
 
-    userJson = DbJson(user->ref);
+    userJson = user->json;
     deviceObj = JsonValueAsObject(HashMapGet(userJson, "devices"));
 
     if (!deviceObj)
     {
-        return false;
+        goto finish;
     }
 
     /* Delete refresh token, if present */
     refreshToken = JsonValueAsString(JsonGet(deviceObj, 2, deviceId, "refreshToken"));
     if (refreshToken)
     {
-        DbDelete(db, 3, "tokens", "refresh", refreshToken);
+        DbDelete(user->db, 3, "tokens", "refresh", refreshToken);
     }
 
     /* Delete the device object */
     deletedVal = HashMapDelete(deviceObj, deviceId);
     if (!deletedVal)
     {
-        return false;
+        goto finish;
     }
     JsonValueFree(deletedVal);
 
     /* Delete the access token. */
-    if (!DbUnlock(db, tokenRef) || !DbDelete(db, 3, "tokens", "access", token))
-    {
-        return false;
-    }
+    ret = UserAccessTokenDelete(user->db, token);
 
-    return true;
+finish:
+    Free(username);
+    Free(deviceId);
+    return ret;
 }
 
 char *
@@ -677,7 +1005,7 @@ UserGetProfile(User * user, char *name)
         return NULL;
     }
 
-    json = DbJson(user->ref);
+    json = user->json;
 
     return JsonValueAsString(JsonGet(json, 2, "profile", name));
 }
@@ -687,13 +1015,21 @@ UserSetProfile(User * user, char *name, char *val)
 {
     HashMap *json = NULL;
 
-    if (!user || !name || !val)
+    if (!user || user->readOnly || !name || !val)
     {
         return;
     }
 
-    json = DbJson(user->ref);
+    json = user->json;
     JsonValueFree(JsonSet(json, JsonValueString(val), 2, "profile", name));
+
+    /* Deactivated users are kept out of the index. */
+    if ((StrEquals(name, "displayname") || StrEquals(name, "avatar_url")) &&
+        !UserDeactivated(user))
+    {
+        UserIndexPut(UserGetName(user), UserGetProfile(user, "displayname"),
+                     UserGetProfile(user, "avatar_url"));
+    }
 }
 
 bool
@@ -703,12 +1039,12 @@ UserDeleteTokens(User * user, char *exempt)
     char *deviceId;
     JsonValue *deviceObj;
 
-    if (!user)
+    if (!user || user->readOnly)
     {
         return false;
     }
 
-    devices = JsonValueAsObject(HashMapGet(DbJson(user->ref), "devices"));
+    devices = JsonValueAsObject(HashMapGet(user->json, "devices"));
     if (!devices)
     {
         return false;
@@ -727,7 +1063,7 @@ UserDeleteTokens(User * user, char *exempt)
 
         if (accessToken)
         {
-            DbDelete(user->db, 3, "tokens", "access", accessToken);
+            UserAccessTokenDelete(user->db, accessToken);
         }
 
         if (refreshToken)
@@ -749,7 +1085,12 @@ UserGetPrivileges(User * user)
         return USER_NONE;
     }
 
-    return UserDecodePrivileges(JsonValueAsArray(HashMapGet(DbJson(user->ref), "privileges")));
+    if (user->privileges < 0)
+    {
+        user->privileges = UserDecodePrivileges(JsonValueAsArray(HashMapGet(user->json, "privileges")));
+    }
+
+    return user->privileges;
 }
 
 bool
@@ -757,14 +1098,17 @@ UserSetPrivileges(User * user, int privileges)
 {
     JsonValue *val;
 
-    if (!user)
+    if (!user || user->readOnly)
     {
         return false;
     }
 
+    TokenCacheInvalidateUser(UserGetName(user));
+
     if (!privileges)
     {
-        JsonValueFree(HashMapDelete(DbJson(user->ref), "privileges"));
+        JsonValueFree(HashMapDelete(user->json, "privileges"));
+        user->privileges = USER_NONE;
         return true;
     }
 
@@ -774,7 +1118,8 @@ UserSetPrivileges(User * user, int privileges)
         return false;
     }
 
-    JsonValueFree(HashMapSet(DbJson(user->ref), "privileges", val));
+    JsonValueFree(HashMapSet(user->json, "privileges", val));
+    user->privileges = privileges;
     return true;
 }
 
@@ -0,0 +1,502 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <UserIndex.h>
+
+#include <Cytoplasm/Memory.h>
+#include <Cytoplasm/HashMap.h>
+#include <Cytoplasm/Str.h>
+#include <Cytoplasm/Log.h>
+
+#include <User.h>
+
+#include <pthread.h>
+#include <string.h>
+
+typedef struct IndexEntry
+{
+    char *name;
+    char *displayName;
+    char *avatarUrl;
+
+    char *lowerName;
+    char *lowerDisplayName;
+} IndexEntry;
+
+typedef struct Posting
+{
+    HashMap *entries;
+    size_t count;
+} Posting;
+
+typedef struct Ranked
+{
+    IndexEntry *entry;
+    int score;
+} Ranked;
+
+static pthread_rwlock_t indexLock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Localpart to IndexEntry */
+static HashMap *entries = NULL;
+static size_t count = 0;
+
+/* Trigram to Posting */
+static HashMap *postings = NULL;
+static int ready = 0;
+
+static pthread_t buildThread;
+static int building = 0;
+static volatile int stopBuild = 0;
+
+/* Must be called with the index locked for writing. */
+static void
+PostingsUpdate(IndexEntry * entry, char *str, int add)
+{
+    char tri[4];
+    size_t len;
+    size_t i;
+
+    if (!str)
+    {
+        return;
+    }
+
+    len = strlen(str);
+    tri[3] = '\0';
+
+    for (i = 0; i + 3 <= len; i++)
+    {
+        Posting *posting;
+
+        memcpy(tri, str + i, 3);
+        posting = HashMapGet(postings, tri);
+
+        if (add)
+        {
+            if (!posting)
+            {
+                posting = Malloc(sizeof(Posting));
+                posting->entries = HashMapCreate();
+                posting->count = 0;
+                HashMapSet(postings, tri, posting);
+            }
+
+            if (!HashMapSet(posting->entries, entry->name, entry))
+            {
+                posting->count++;
+            }
+        }
+        else if (posting && HashMapDelete(posting->entries, entry->name))
+        {
+            posting->count--;
+            if (!posting->count)
+            {
+                HashMapDelete(postings, tri);
+                HashMapFree(posting->entries);
+                Free(posting);
+            }
+        }
+    }
+}
+
+static void
+EntryFree(IndexEntry * entry)
+{
+    Free(entry->name);
+    Free(entry->displayName);
+    Free(entry->avatarUrl);
+    Free(entry->lowerName);
+    Free(entry->lowerDisplayName);
+    Free(entry);
+}
+
+/* Must be called with the index locked for writing. */
+static void
+EntryRemove(char *name)
+{
+    IndexEntry *entry = HashMapGet(entries, name);
+
+    if (!entry)
+    {
+        return;
+    }
+
+    PostingsUpdate(entry, entry->lowerName, 0);
+    PostingsUpdate(entry, entry->lowerDisplayName, 0);
+    HashMapDelete(entries, name);
+    EntryFree(entry);
+    count--;
+}
+
+static void *
+UserIndexBuild(void *argp)
+{
+    Db *db = argp;
+    Array *users = DbList(db, 1, "users");
+    size_t i;
+
+    for (i = 0; i < ArraySize(users) && !stopBuild; i++)
+    {
+        User *user = UserLock(db, ArrayGet(users, i));
+
+        if (!user)
+        {
+            continue;
+        }
+
+        /* The user stays locked while it is added, so that the entry
+         * can't be overtaken by a concurrent profile change. */
+        if (!UserDeactivated(user))
+        {
+            UserIndexPut(UserGetName(user),
+                         UserGetProfile(user, "displayname"),
+                         UserGetProfile(user, "avatar_url"));
+        }
+
+        UserUnlock(user);
+    }
+
+    if (!stopBuild)
+    {
+        pthread_rwlock_wrlock(&indexLock);
+        ready = 1;
+        pthread_rwlock_unlock(&indexLock);
+
+        Log(LOG_DEBUG, "User directory index built with %lu users.",
+            ArraySize(users));
+    }
+
+    DbListFree(users);
+    return NULL;
+}
+
+void
+UserIndexInit(Db * db)
+{
+    pthread_rwlock_wrlock(&indexLock);
+    if (entries)
+    {
+        pthread_rwlock_unlock(&indexLock);
+        return;
+    }
+
+    entries = HashMapCreate();
+    postings = HashMapCreate();
+    ready = 0;
+    pthread_rwlock_unlock(&indexLock);
+
+    stopBuild = 0;
+    if (pthread_create(&buildThread, NULL, UserIndexBuild, db) != 0)
+    {
+        Log(LOG_WARNING, "Unable to build the user directory index.");
+        return;
+    }
+    building = 1;
+}
+
+void
+UserIndexFree(void)
+{
+    char *key;
+    void *val;
+
+    if (building)
+    {
+        stopBuild = 1;
+        pthread_join(buildThread, NULL);
+        building = 0;
+    }
+
+    pthread_rwlock_wrlock(&indexLock);
+    if (postings)
+    {
+        while (HashMapIterate(postings, &key, &val))
+        {
+            Posting *posting = val;
+
+            HashMapFree(posting->entries);
+            Free(posting);
+        }
+        HashMapFree(postings);
+        postings = NULL;
+    }
+
+    if (entries)
+    {
+        while (HashMapIterate(entries, &key, &val))
+        {
+            EntryFree(val);
+        }
+        HashMapFree(entries);
+        entries = NULL;
+        count = 0;
+    }
+
+    ready = 0;
+    pthread_rwlock_unlock(&indexLock);
+}
+
+void
+UserIndexPut(char *name, char *displayName, char *avatarUrl)
+{
+    IndexEntry *entry;
+
+    if (!name)
+    {
+        return;
+    }
+
+    entry = Malloc(sizeof(IndexEntry));
+    if (!entry)
+    {
+        return;
+    }
+
+    entry->name = StrDuplicate(name);
+    entry->displayName = StrDuplicate(displayName);
+    entry->avatarUrl = StrDuplicate(avatarUrl);
+    entry->lowerName = StrLower(name);
+    entry->lowerDisplayName = displayName ? StrLower(displayName) : NULL;
+
+    pthread_rwlock_wrlock(&indexLock);
+    if (!entries)
+    {
+        pthread_rwlock_unlock(&indexLock);
+        EntryFree(entry);
+        return;
+    }
+
+    EntryRemove(name);
+    HashMapSet(entries, entry->name, entry);
+    count++;
+    PostingsUpdate(entry, entry->lowerName, 1);
+    PostingsUpdate(entry, entry->lowerDisplayName, 1);
+    pthread_rwlock_unlock(&indexLock);
+}
+
+void
+UserIndexRemove(char *name)
+{
+    if (!name)
+    {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&indexLock);
+    if (entries)
+    {
+        EntryRemove(name);
+    }
+    pthread_rwlock_unlock(&indexLock);
+}
+
+static int
+Score(IndexEntry * entry, char *term)
+{
+    size_t len = strlen(term);
+    char *display = entry->lowerDisplayName;
+
+    if (StrEquals(entry->lowerName, term) || StrEquals(display, term))
+    {
+        return 0;
+    }
+
+    if (strncmp(entry->lowerName, term, len) == 0 ||
+        (display && strncmp(display, term, len) == 0))
+    {
+        return 1;
+    }
+
+    if (strstr(entry->lowerName, term) || (display && strstr(display, term)))
+    {
+        return 2;
+    }
+
+    return -1;
+}
+
+static int
+RankedBefore(IndexEntry * entry, int score, Ranked * other)
+{
+    if (score != other->score)
+    {
+        return score < other->score;
+    }
+
+    return strcmp(entry->name, other->entry->name) < 0;
+}
+
+Array *
+UserIndexSearch(char *term, size_t limit, int *limited)
+{
+    char *lower;
+    HashMap *candidates = NULL;
+    Ranked *top;
+    size_t found = 0;
+    size_t total = 0;
+    size_t iter = 0;
+    char *key;
+    void *val;
+    Array *results;
+    size_t i;
+
+    if (!term || !limited)
+    {
+        return NULL;
+    }
+
+    if (limit > USER_INDEX_MAX_LIMIT)
+    {
+        limit = USER_INDEX_MAX_LIMIT;
+    }
+
+    pthread_rwlock_rdlock(&indexLock);
+    if (!ready)
+    {
+        pthread_rwlock_unlock(&indexLock);
+        return NULL;
+    }
+
+    /* There can't be more results than users. */
+    if (limit > count)
+    {
+        limit = count;
+    }
+
+    lower = StrLower(term);
+    top = Malloc(sizeof(Ranked) * (limit + 1));
+    if (!lower || !top)
+    {
+        pthread_rwlock_unlock(&indexLock);
+        Free(lower);
+        Free(top);
+        return NULL;
+    }
+
+    if (strlen(lower) < 3)
+    {
+        /* Too short for a trigram, so every user is a candidate. */
+        candidates = entries;
+    }
+    else
+    {
+        char tri[4];
+        size_t best = 0;
+
+        /* Only the users in the smallest posting list can match. */
+        tri[3] = '\0';
+        for (i = 0; i + 3 <= strlen(lower); i++)
+        {
+            Posting *posting;
+
+            memcpy(tri, lower + i, 3);
+            posting = HashMapGet(postings, tri);
+            if (!posting)
+            {
+                candidates = NULL;
+                break;
+            }
+
+            if (!candidates || posting->count < best)
+            {
+                candidates = posting->entries;
+                best = posting->count;
+            }
+        }
+    }
+
+    while (candidates && HashMapIterateReentrant(candidates, &key, &val, &iter))
+    {
+        IndexEntry *entry = val;
+        int score = Score(entry, lower);
+        size_t pos;
+
+        if (score < 0)
+        {
+            continue;
+        }
+
+        total++;
+
+        /* Keep only the best results, in order. */
+        pos = found;
+        while (pos > 0 && RankedBefore(entry, score, &top[pos - 1]))
+        {
+            top[pos] = top[pos - 1];
+            pos--;
+        }
+
+        if (pos < limit)
+        {
+            top[pos].entry = entry;
+            top[pos].score = score;
+            if (found < limit)
+            {
+                found++;
+            }
+        }
+    }
+
+    results = ArrayCreate();
+    for (i = 0; i < found; i++)
+    {
+        UserIndexResult *result = Malloc(sizeof(UserIndexResult));
+
+        if (!result)
+        {
+            break;
+        }
+
+        result->name = StrDuplicate(top[i].entry->name);
+        result->displayName = StrDuplicate(top[i].entry->displayName);
+        result->avatarUrl = StrDuplicate(top[i].entry->avatarUrl);
+        ArrayAdd(results, result);
+    }
+    pthread_rwlock_unlock(&indexLock);
+
+    *limited = total > found;
+
+    Free(lower);
+    Free(top);
+    return results;
+}
+
+void
+UserIndexResultsFree(Array * results)
+{
+    size_t i;
+
+    for (i = 0; i < ArraySize(results); i++)
+    {
+        UserIndexResult *result = ArrayGet(results, i);
+
+        Free(result->name);
+        Free(result->displayName);
+        Free(result->avatarUrl);
+        Free(result);
+    }
+
+    ArrayFree(results);
+}
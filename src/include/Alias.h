@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TELODENDRIA_ALIAS_H
+#define TELODENDRIA_ALIAS_H
+
+/***
+ * @Nm Alias
+ * @Nd Store and resolve local room aliases.
+ * @Dd October 15 2026
+ * @Xr Room Db
+ *
+ * .Nm
+ * manages the mapping between room aliases and room IDs. Each alias
+ * is stored in its own database object, and each room has its own
+ * object listing its aliases, so operations on different aliases
+ * and rooms never wait on each other.
+ * .Pp
+ * Resolving an alias is by far the most common operation, so resolved
+ * aliases are also kept in memory behind a reader-writer lock, and
+ * concurrent lookups of a cached alias don't touch the database.
+ * .Pp
+ * Older versions of Telodendria kept all aliases in one
+ * .Dq aliases
+ * object.
+ * .Fn AliasInit
+ * migrates that object to the new layout the first time it runs.
+ */
+
+#include <Cytoplasm/Db.h>
+#include <Cytoplasm/HashMap.h>
+#include <Cytoplasm/Json.h>
+
+/**
+ * The outcome of an operation that modifies an alias.
+ */
+typedef enum AliasStatus
+{
+    ALIAS_OK,
+    ALIAS_EXISTS,
+    ALIAS_NOT_FOUND,
+    ALIAS_FORBIDDEN,
+    ALIAS_ERROR
+} AliasStatus;
+
+/**
+ * Set up the alias cache and migrate aliases from the old
+ * single-object layout in the given database, if it is present. This
+ * function returns a boolean value indicating success.
+ */
+extern int AliasInit(Db *);
+
+/**
+ * Free the alias cache.
+ */
+extern void AliasFree(void);
+
+/**
+ * Resolve an alias, returning a new JSON object with the
+ * .Dq room_id
+ * and
+ * .Dq servers
+ * keys, as required by the client-server API, or NULL if the alias
+ * does not exist. The caller must free the returned object.
+ */
+extern HashMap * AliasResolve(Db *, char *);
+
+/**
+ * Map an alias to a room ID on behalf of the given user localpart.
+ * This function returns
+ * .Dv ALIAS_EXISTS
+ * if the alias is already mapped.
+ */
+extern AliasStatus AliasCreate(Db *, char *, char *, char *);
+
+/**
+ * Remove an alias on behalf of the given user localpart. Only the
+ * user that created the alias may remove it, unless the boolean
+ * argument indicates that the user is privileged to remove any alias.
+ */
+extern AliasStatus AliasDelete(Db *, char *, char *, int);
+
+/**
+ * Get the aliases of the given room ID as a new JSON array, or NULL
+ * if the room has never had any aliases. The caller must free the
+ * returned value with
+ * .Fn JsonValueFree .
+ */
+extern JsonValue * AliasList(Db *, char *);
+
+#endif                             /* TELODENDRIA_ALIAS_H */
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TELODENDRIA_ARENA_H
+#define TELODENDRIA_ARENA_H
+
+/***
+ * @Nm Arena
+ * @Nd Allocate request temporaries that are all freed at once.
+ * @Dd October 15 2026
+ * @Xr Memory Str Matrix
+ *
+ * .Nm
+ * hands out memory from large blocks, so that short-lived values,
+ * such as the strings a route function builds while handling a
+ * request, don't each go through the Memory API. Memory from an arena
+ * is never freed on its own; it is all released together when the
+ * arena is reset or freed.
+ * .Pp
+ * In debug builds, which define
+ * .Dv TELODENDRIA_DEBUG ,
+ * every allocation is made through the Memory API instead, so that it
+ * still shows up in memory tracking and hooks.
+ * .Pp
+ * An arena is not safe to share between threads.
+ */
+
+#include <stddef.h>
+
+/**
+ * An opaque structure that holds the blocks of an arena.
+ */
+typedef struct Arena Arena;
+
+/**
+ * Create an arena that allocates blocks of the given size, returning
+ * NULL if memory could not be allocated. One block is always kept,
+ * even after the arena is reset.
+ */
+extern Arena * ArenaCreate(size_t);
+
+/**
+ * Allocate memory from the arena. The memory is suitably aligned for
+ * any type, and it is valid until the arena is reset or freed. This
+ * function returns NULL if memory could not be allocated.
+ */
+extern void * ArenaAlloc(Arena *, size_t);
+
+/**
+ * Like
+ * .Fn StrDuplicate ,
+ * but the copy is allocated from the arena.
+ */
+extern char * ArenaStrDuplicate(Arena *, const char *);
+
+/**
+ * Like
+ * .Fn StrConcat ,
+ * but the result is allocated from the arena.
+ */
+extern char * ArenaStrConcat(Arena *, size_t,...);
+
+/**
+ * Like
+ * .Fn StrLower ,
+ * but the result is allocated from the arena.
+ */
+extern char * ArenaStrLower(Arena *, const char *);
+
+/**
+ * Release everything allocated from the arena, keeping its first
+ * block for reuse.
+ */
+extern void ArenaReset(Arena *);
+
+/**
+ * Free the arena and everything allocated from it.
+ */
+extern void ArenaFree(Arena *);
+
+#endif                             /* TELODENDRIA_ARENA_H */
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TELODENDRIA_BUFFER_H
+#define TELODENDRIA_BUFFER_H
+
+/***
+ * @Nm Buffer
+ * @Nd A growable in-memory stream.
+ * @Dd October 15 2026
+ * @Xr Stream Io
+ *
+ * .Nm
+ * collects everything written to a stream in memory, so that it can
+ * be measured and sent all at once. Telodendria uses it to build
+ * response bodies, because the length of a body must be known before
+ * the headers can be sent.
+ */
+
+#include <Cytoplasm/Stream.h>
+
+#include <stddef.h>
+
+/**
+ * An opaque structure that holds the buffered data and the stream
+ * that writes to it.
+ */
+typedef struct Buffer Buffer;
+
+/**
+ * Create a new, empty buffer, returning NULL if memory could not be
+ * allocated.
+ */
+extern Buffer * BufferCreate(void);
+
+/**
+ * Get the stream that writes to the given buffer. The stream belongs
+ * to the buffer and must not be closed by the caller.
+ */
+extern Stream * BufferStream(Buffer *);
+
+/**
+ * Get the data written to the buffer so far. The returned pointer is
+ * only valid until the buffer is written to again, reset, or freed.
+ */
+extern char * BufferData(Buffer *);
+
+/**
+ * Get the number of bytes written to the buffer so far.
+ */
+extern size_t BufferLength(Buffer *);
+
+/**
+ * Write the contents of the buffer to another stream, returning the
+ * number of bytes written, or -1 if an error occurred.
+ */
+extern ssize_t BufferSend(Buffer *, Stream *);
+
+/**
+ * Write the given number of bytes to a stream as a block, rather than
+ * a byte at a time. If the stream has a file descriptor, the stream is
+ * flushed and the bytes are written to the descriptor directly. This
+ * function returns the number of bytes written, or -1 if an error
+ * occurred.
+ */
+extern ssize_t BufferWriteBlock(Stream *, const char *, size_t);
+
+/**
+ * Discard the contents of the buffer so that it can be reused,
+ * without giving back the memory it has allocated.
+ */
+extern void BufferReset(Buffer *);
+
+/**
+ * Free the buffer, its stream, and its data.
+ */
+extern void BufferFree(Buffer *);
+
+#endif                             /* TELODENDRIA_BUFFER_H */
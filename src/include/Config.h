@@ -44,6 +44,12 @@
  * convenience methods for extracting the configuration out of the
  * database.
  * .Pp
+ * Most of the server only ever reads the configuration, so it is also
+ * kept parsed in memory as a read-only snapshot that request handlers
+ * can share without going to the database. When the configuration
+ * changes, a new snapshot is published; handlers that are still using
+ * the old one keep it until they release it.
+ * .Pp
  * This documentation does not describe the actual format of the
  * configuration file; for that, consult
  * .Xr telodendria-config 7 .
@@ -55,6 +61,12 @@
 #include <Cytoplasm/Array.h>
 #include <Cytoplasm/Db.h>
 
+/**
+ * The holder of the currently published configuration snapshot. This
+ * is an opaque structure that is safe to share between threads.
+ */
+typedef struct ConfigStore ConfigStore;
+
 /**
  * Parse a JSON object, extracting the necessary values, validating
  * them, and adding them to the configuration structure for use by the
@@ -103,4 +115,44 @@ extern int ConfigUnlock(Config *);
  */
 extern int ConfigLogLevelToSyslog(ConfigLogLevel);
 
+/**
+ * Create a configuration store, publishing the given raw
+ * configuration as the first snapshot. This function returns NULL if
+ * the configuration could not be parsed.
+ */
+extern ConfigStore * ConfigStoreCreate(HashMap *);
+
+/**
+ * Parse the given raw configuration and publish it as the new
+ * snapshot, replacing the current one. Requests that are already
+ * holding the current snapshot are unaffected. This should be called
+ * whenever the configuration in the database is changed, and it
+ * returns a boolean value indicating whether the new configuration
+ * was valid and has been published.
+ */
+extern int ConfigStoreUpdate(ConfigStore *, HashMap *);
+
+/**
+ * Free a configuration store and its current snapshot. No snapshots
+ * may still be held when this is called.
+ */
+extern void ConfigStoreFree(ConfigStore *);
+
+/**
+ * Get a reference to the current configuration snapshot. The returned
+ * configuration must not be modified, and it must be given back with
+ * .Fn ConfigRelease
+ * when the caller is done with it. Unlike
+ * .Fn ConfigLock ,
+ * this does not touch the database, so it is cheap enough to call on
+ * every request.
+ */
+extern Config * ConfigAcquire(ConfigStore *);
+
+/**
+ * Release a configuration snapshot obtained with
+ * .Fn ConfigAcquire .
+ */
+extern void ConfigRelease(ConfigStore *, Config *);
+
 #endif                             /* TELODENDRIA_CONFIG_H */
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TELODENDRIA_DEFLATE_H
+#define TELODENDRIA_DEFLATE_H
+
+/***
+ * @Nm Deflate
+ * @Nd Compress data with the DEFLATE algorithm.
+ * @Dd October 15 2026
+ * @Xr Io Matrix
+ *
+ * .Nm
+ * implements a DEFLATE compressor, as described in RFC 1951, producing
+ * output in either the zlib (RFC 1950) or gzip (RFC 1952) format. It
+ * is used to compress HTTP responses for clients that accept them.
+ * .Pp
+ * The compressed data is handed to a write function, in the same form
+ * as the write function of an
+ * .Xr Io 3
+ * stream, a piece at a time as it is produced, so the caller never
+ * has to hold all of the compressed output in memory.
+ */
+
+#include <Cytoplasm/Io.h>
+
+#include <stddef.h>
+
+/**
+ * The container format to wrap the compressed data in. These
+ * correspond to the
+ * .Dq deflate
+ * and
+ * .Dq gzip
+ * HTTP content codings.
+ */
+typedef enum DeflateFormat
+{
+    DEFLATE_ZLIB,
+    DEFLATE_GZIP
+} DeflateFormat;
+
+/**
+ * The compression level used when no other level is specified.
+ */
+#define DEFLATE_DEFAULT_LEVEL 6
+
+/**
+ * Compress the given data in the given format, at the given
+ * compression level from 1 (fastest) to 9 (smallest), passing the
+ * output to the given write function along with the given pointer.
+ * This function returns a boolean value indicating whether all of the
+ * output was written successfully.
+ */
+extern int
+ DeflateCompress(DeflateFormat, int, unsigned char *, size_t, IoWriteFunc *, void *);
+
+#endif                             /* TELODENDRIA_DEFLATE_H */
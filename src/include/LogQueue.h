@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TELODENDRIA_LOGQUEUE_H
+#define TELODENDRIA_LOGQUEUE_H
+
+/***
+ * @Nm LogQueue
+ * @Nd Write log messages from a background thread.
+ * @Dd October 15 2026
+ * @Xr Log Stream
+ *
+ * .Nm
+ * provides a stream that can be given to
+ * .Fn LogConfigOutputSet
+ * so that logging never waits on the disk. Messages written to the
+ * stream are copied into a fixed-size ring buffer, and a dedicated
+ * thread writes them out in batches. When writing to a file, the
+ * thread can also rotate the file when it gets too large or too old.
+ * .Pp
+ * If messages are logged faster than they can be written and the ring
+ * buffer fills up, the queue either makes the logging thread wait for
+ * space, or drops the message and counts it. Dropped messages are
+ * reported in the log once there is room again.
+ */
+
+#include <Cytoplasm/Stream.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The size of the ring buffer if no other size is given to
+ * .Fn LogQueueCreate .
+ */
+#define LOG_QUEUE_DEFAULT_SIZE (1024 * 1024)
+
+/**
+ * An opaque structure that holds the ring buffer, the writer thread
+ * and the output.
+ */
+typedef struct LogQueue LogQueue;
+
+/**
+ * Start a log queue. The first argument is the path of the file to
+ * append messages to, or NULL to write to standard output. The
+ * remaining arguments are the size of the ring buffer in bytes, or 0
+ * for the default; a boolean value indicating whether a full buffer
+ * should block the logging thread instead of dropping the message;
+ * the file size in bytes at which the file is rotated; and the age in
+ * seconds at which the file is rotated. A rotation limit of 0 means
+ * the file is never rotated for that reason. This function returns
+ * NULL if the output could not be opened or the thread could not be
+ * started.
+ */
+extern LogQueue * LogQueueCreate(char *, size_t, int, uint64_t, uint64_t);
+
+/**
+ * Get the stream that writes to the given log queue. The stream
+ * belongs to the queue and must not be closed by the caller.
+ */
+extern Stream * LogQueueStream(LogQueue *);
+
+/**
+ * Write out everything left in the queue, stop the writer thread, and
+ * free the queue. Nothing may still be writing to the queue's stream
+ * when this is called.
+ */
+extern void LogQueueFree(LogQueue *);
+
+#endif                             /* TELODENDRIA_LOGQUEUE_H */
@@ -45,6 +45,8 @@
 #include <Config.h>
 #include <Cytoplasm/Db.h>
 
+#include <pthread.h>
+
 /**
  * The valid errors that can be used with
  * .Fn MatrixErrorCreate .
@@ -88,22 +90,60 @@ typedef enum MatrixError
 } MatrixError;
 
 /**
- * The arguments that should be passed through the void pointer to the
- * .Fn MatrixHttpHandler
- * function. This structure should be populated once, and then never
- * modified again for the duration of the HTTP server.
+ * The arguments shared by all of the HTTP listeners. This structure
+ * should be populated once, and then never modified again for the
+ * duration of the HTTP server.
  */
 typedef struct MatrixHttpHandlerArgs
 {
     Db *db;
     HttpRouter *router;
+    ConfigStore *config;
 } MatrixHttpHandlerArgs;
 
+/**
+ * The arguments that should be passed through the void pointer to the
+ * .Fn MatrixHttpHandler
+ * function. Each listener gets its own copy, which holds the settings
+ * that can differ between listeners. Like the shared arguments, the
+ * settings should not be modified while the HTTP server is running;
+ * the lock and the in-flight count are managed by
+ * .Fn MatrixHttpHandler .
+ */
+typedef struct MatrixListenerArgs
+{
+    MatrixHttpHandlerArgs *matrixArgs;
+
+    /* The port the listener is bound to, to tell listeners apart in
+     * metrics. */
+    int port;
+
+    /* Responses at least this long are compressed for clients that
+     * accept it; 0 disables compression. */
+    size_t compressThreshold;
+    int compressLevel;
+
+    /* Requests are turned away with a 503 if they waited longer than
+     * this many milliseconds to be picked up, or if more than this
+     * many requests are already being handled; 0 disables either. */
+    unsigned long maxQueueDelay;
+    unsigned int maxInFlight;
+
+    pthread_mutex_t lock;
+    unsigned int inFlight;
+
+    /* The connection is shut down if reading the request body or
+     * sending the response takes longer than this many milliseconds;
+     * 0 disables either. */
+    long bodyTimeout;
+    long sendTimeout;
+} MatrixListenerArgs;
+
 /**
  * The HTTP handler function that handles all Matrix homeserver
  * functionality. It should be passed into
  * .Fn HttpServerCreate ,
- * and it expects that a pointer to a MatrixHttpHandlerArgs
+ * and it expects that a pointer to a MatrixListenerArgs
  * will be provided, because that is what the void pointer is
  * cast to.
  */
@@ -135,15 +175,20 @@ extern HashMap * MatrixErrorCreate(MatrixError, char *);
 extern HashMap * MatrixGetAccessToken(HttpServerContext *, char **);
 
 /**
- * Determine whether or not the request should be rate limited. It is
- * expected that this function will be called before most, if not all
- * of the caller's logic.
+ * Determine whether or not the request should be rate limited. A
+ * token is taken from the bucket of the remote address, and from the
+ * bucket of the user if the request carries an access token whose
+ * user is known without going to the database. Login, registration,
+ * and user-interactive authentication endpoints have their own,
+ * stricter budget. This is called by
+ * .Fn MatrixHttpHandler
+ * before any route function runs.
  * .Pp
  * If this function returns a non-NULL value, then the return value
  * should be immediately passed along to the client and no further
  * logic should be performed.
  */
-extern HashMap * MatrixRateLimit(HttpServerContext *, Db *);
+extern HashMap * MatrixRateLimit(HttpServerContext *, MatrixHttpHandlerArgs *);
 
 /**
  * Build a ``well-known'' JSON object, which contains information
@@ -154,4 +199,14 @@ extern HashMap * MatrixRateLimit(HttpServerContext *, Db *);
  */
 extern HashMap * MatrixClientWellKnown(char *, char *);
 
+/**
+ * Decode the JSON body of a request, returning NULL if it isn't a
+ * valid JSON object. Route functions should use this rather than
+ * decoding the request stream themselves, so that the time spent
+ * decoding shows up in slow request traces, and so that the
+ * listener's body timeout applies. A body that timed out is treated
+ * as invalid.
+ */
+extern HashMap * MatrixRequestJson(HttpServerContext *);
+
 #endif
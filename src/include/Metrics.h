@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TELODENDRIA_METRICS_H
+#define TELODENDRIA_METRICS_H
+
+/***
+ * @Nm Metrics
+ * @Nd Runtime counters exported in the Prometheus text format.
+ * @Dd October 15 2026
+ * @Xr Matrix Routes TokenCache
+ *
+ * .Nm
+ * collects request counts, latencies, response codes, in-flight
+ * requests, and background job durations, and writes them out in the
+ * Prometheus text exposition format.
+ * .Pp
+ * Every thread records into its own set of counters, which only that
+ * thread and the exporter ever lock, so recording a value never waits
+ * on another request. The counters of all threads are only added up
+ * when they are exported. Counters are kept when a thread exits, so
+ * they only ever go up until
+ * .Fn MetricsFree
+ * is called.
+ */
+
+#include <Cytoplasm/Stream.h>
+
+#include <stdint.h>
+
+/**
+ * Get the current time in microseconds, from a clock that is suitable
+ * for measuring durations.
+ */
+extern uint64_t MetricsNow(void);
+
+/**
+ * Record a request that has been handled. This takes the name of the
+ * route function that handled it, or NULL if no route matched, the
+ * response status, and how long it took in microseconds.
+ */
+extern void MetricsRequest(char *, int, uint64_t);
+
+/**
+ * Add the given amount, which may be negative, to the number of
+ * requests in flight on the listener with the given port.
+ */
+extern void MetricsActive(int, int);
+
+/**
+ * Note the number of worker threads the listener with the given port
+ * was started with.
+ */
+extern void MetricsThreads(int, unsigned int);
+
+/**
+ * Record how long a request waited on the listener with the given
+ * port before it was picked up, in microseconds.
+ */
+extern void MetricsQueued(int, uint64_t);
+
+/**
+ * Record that a request on the listener with the given port was
+ * turned away because the listener was overloaded.
+ */
+extern void MetricsShed(int);
+
+/**
+ * Record how long a run of the named background job took, in
+ * microseconds.
+ */
+extern void MetricsJob(char *, uint64_t);
+
+/**
+ * Note that the route function with the given name is registered
+ * under the given path pattern, so that the exported route names can
+ * be mapped back to their patterns.
+ */
+extern void MetricsRouteAdd(char *, char *);
+
+/**
+ * Write all metrics to the given stream in the Prometheus text
+ * exposition format.
+ */
+extern void MetricsWrite(Stream *);
+
+/**
+ * Free all recorded metrics. No other thread may be recording when
+ * this is called.
+ */
+extern void MetricsFree(void);
+
+#endif                             /* TELODENDRIA_METRICS_H */
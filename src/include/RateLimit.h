@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TELODENDRIA_RATELIMIT_H
+#define TELODENDRIA_RATELIMIT_H
+
+/***
+ * @Nm RateLimit
+ * @Nd In-memory token buckets for limiting request rates.
+ * @Dd October 15 2026
+ * @Xr Matrix Config
+ *
+ * .Nm
+ * keeps a token bucket for every key it is asked about, such as a
+ * remote address or a user. Each request takes one token from its
+ * bucket, and the bucket refills at a steady rate up to its burst
+ * size. A request that finds its bucket empty should be rejected.
+ * .Pp
+ * The buckets are kept in memory only, split into a number of
+ * shards that each have their own lock, so that requests for
+ * different keys rarely wait on each other. Buckets that have refilled
+ * completely carry no information, so
+ * .Fn RateLimitCompact
+ * should be run periodically to drop them.
+ * .Pp
+ * Until
+ * .Fn RateLimitInit
+ * is called, every request is allowed.
+ */
+
+#include <stdint.h>
+
+/**
+ * Set up the global bucket table.
+ */
+extern void RateLimitInit(void);
+
+/**
+ * Free the global bucket table and all of its buckets.
+ */
+extern void RateLimitFree(void);
+
+/**
+ * Take a token from the bucket with the given key, which refills at
+ * the given number of tokens per minute and holds at most the given
+ * burst size. This function returns 0 if a token was taken, or else
+ * the number of milliseconds until one will be available. A rate of
+ * 0 means no limit.
+ */
+extern uint64_t RateLimitTake(char *, unsigned long, unsigned long);
+
+/**
+ * Drop all buckets that have refilled completely. This is meant to be
+ * run as a periodic job.
+ */
+extern void RateLimitCompact(void);
+
+#endif                             /* TELODENDRIA_RATELIMIT_H */
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TELODENDRIA_REAPER_H
+#define TELODENDRIA_REAPER_H
+
+/***
+ * @Nm Reaper
+ * @Nd Enforce deadlines on connections from a single timer thread.
+ * @Dd October 15 2026
+ * @Xr Matrix Config
+ *
+ * .Nm
+ * bounds how long a request may block on its connection. Before a
+ * handler starts reading a request body or sending a response, it arms
+ * a deadline for its connection, and it disarms the deadline once it
+ * is done. If the deadline passes first, the connection is shut down,
+ * so that the blocked read or write fails and the thread is freed.
+ * .Pp
+ * All deadlines are kept in one heap, ordered by expiry, and watched
+ * by a single thread, instead of each connection setting its own
+ * alarm. Deadlines are armed from the caller's own memory, so arming
+ * and disarming one never allocates unless the heap has to grow.
+ * .Pp
+ * Until
+ * .Fn ReaperInit
+ * is called, arming a deadline does nothing.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * What a connection was doing when its deadline was armed.
+ */
+typedef enum ReaperState
+{
+    REAPER_BODY,
+    REAPER_SEND,
+    REAPER_STATES
+} ReaperState;
+
+/**
+ * A deadline for one connection. This is owned by the caller, usually
+ * on its stack, and must stay valid until it is disarmed. Its fields
+ * are private to
+ * .Nm .
+ */
+typedef struct ReaperEntry
+{
+    int fd;
+    ReaperState state;
+    uint64_t deadline;
+    size_t index;
+    int reaped;
+} ReaperEntry;
+
+/**
+ * Start the timer thread. This function returns a boolean value
+ * indicating whether it was started.
+ */
+extern int ReaperInit(void);
+
+/**
+ * Stop the timer thread. No deadlines may be armed when this is
+ * called.
+ */
+extern void ReaperFree(void);
+
+/**
+ * Arm a deadline the given number of milliseconds from now for the
+ * given file descriptor, in the given state. Nothing is armed if the
+ * file descriptor is negative or the timeout is not positive; the
+ * entry can still be disarmed.
+ */
+extern void ReaperArm(ReaperEntry *, int, ReaperState, long);
+
+/**
+ * Disarm a deadline. This function returns a boolean value indicating
+ * whether the deadline had already passed and the connection was shut
+ * down.
+ */
+extern int ReaperDisarm(ReaperEntry *);
+
+/**
+ * Get the number of connections that have been shut down in the given
+ * state.
+ */
+extern uint64_t ReaperCount(ReaperState);
+
+/**
+ * Get the name of a state, as used in metrics.
+ */
+extern const char * ReaperStateToString(ReaperState);
+
+#endif                             /* TELODENDRIA_REAPER_H */
@@ -46,6 +46,7 @@
 #include <Cytoplasm/HttpServer.h>
 #include <Cytoplasm/HttpRouter.h>
 #include <Matrix.h>
+#include <Arena.h>
 
 #include <string.h>
 
@@ -57,6 +58,21 @@ typedef struct RouteArgs
 {
     MatrixHttpHandlerArgs *matrixArgs;
     HttpServerContext *context;
+
+    /* Routes that return NULL write their response body here, after
+     * setting their headers. Do not call HttpSendHeaders(); the body
+     * is sent with a Content-Length once the route returns. */
+    Stream *body;
+
+    /* The name of the route function handling the request, for
+     * metrics. This is set before the route function is entered. */
+    char *route;
+
+    /* Temporaries that are only needed while the request is being
+     * handled can be allocated from here. They are all released once
+     * the response is sent, so they must not be freed, and must not
+     * be stored anywhere that outlives the request. */
+    Arena *arena;
 } RouteArgs;
 
 /**
@@ -69,9 +85,20 @@ extern HttpRouter * RouterBuild(void);
 	extern void * \
 	name(Array *, void *)
 
+/*
+ * Each route function is wrapped so that the request records which
+ * route handled it.
+ */
 #define ROUTE_IMPL(name, path, args) \
+	static void * name##Impl(Array *, void *); \
 	void * \
-	name(Array * path, void * args)
+	name(Array * path, void * args) \
+	{ \
+		((RouteArgs *) args)->route = #name; \
+		return name##Impl(path, args); \
+	} \
+	static void * \
+	name##Impl(Array * path, void * args)
 
 ROUTE(RouteVersions);
 ROUTE(RouteWellKnown);
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TELODENDRIA_SIGNEDTOKEN_H
+#define TELODENDRIA_SIGNEDTOKEN_H
+
+/***
+ * @Nm SignedToken
+ * @Nd Self-contained access tokens that can be verified without storage.
+ * @Dd October 15 2026
+ * @Xr User TokenCache
+ *
+ * .Nm
+ * implements an alternative access token format that carries the
+ * user, device, and expiry time of the token, along with a keyed
+ * SHA-256 signature over them. Such a token can be validated with
+ * nothing but CPU work, so it never has to be written to or read
+ * from the database.
+ * .Pp
+ * Since a signed token cannot be deleted, tokens that are logged out,
+ * refreshed, or belong to a deactivated user are instead added to a
+ * small in-memory revocation set. The set is persisted to an
+ * append-only log in the data directory, which is compacted each time
+ * the server starts by dropping tokens that have expired anyway.
+ * Because of that, only tokens with an expiry time are issued in
+ * this format.
+ * .Pp
+ * The signing secret is generated once and stored in the database, so
+ * tokens survive restarts. Signed tokens are always accepted once
+ * .Fn SignedTokenInit
+ * has been called; the configuration only controls whether or not
+ * new tokens are issued in this format.
+ */
+
+#include <Cytoplasm/Db.h>
+
+#include <stdint.h>
+
+/**
+ * Load the signing secret from the given database, creating it if it
+ * doesn't exist yet, and load and compact the revocation log. The
+ * boolean value controls whether or not
+ * .Fn SignedTokenEnabled
+ * reports that new tokens should be signed. This function returns a
+ * boolean value indicating success.
+ */
+extern int SignedTokenInit(Db *, int);
+
+/**
+ * Free all the memory associated with signed tokens and close the
+ * revocation log.
+ */
+extern void SignedTokenFree(void);
+
+/**
+ * Whether or not new access tokens should be issued as signed
+ * tokens.
+ */
+extern int SignedTokenEnabled(void);
+
+/**
+ * Create a signed token for the given user and device, expiring at
+ * the given timestamp in milliseconds. Signed tokens always expire,
+ * so that the revocation set stays bounded; this function returns
+ * NULL if the timestamp is 0, or if the token could not be created,
+ * in which case the caller should fall back to an opaque token.
+ */
+extern char * SignedTokenCreate(char *, char *, uint64_t);
+
+/**
+ * Check whether the given string looks like a signed token. This
+ * does not validate it in any way; it only tells the caller which
+ * format to expect.
+ */
+extern int SignedTokenIs(char *);
+
+/**
+ * Verify the signature of the given token and check it against the
+ * revocation set. If it is valid, the user and device are duplicated
+ * into the given pointers, which the caller must free, and the expiry
+ * timestamp is stored. Expiry is not checked here. This function
+ * returns a boolean value indicating whether the token is valid.
+ */
+extern int SignedTokenVerify(char *, char **, char **, uint64_t *);
+
+/**
+ * Revoke the given signed token, so that it will no longer pass
+ * .Fn SignedTokenVerify .
+ * The revocation is appended to the revocation log before this
+ * function returns. It returns a boolean value indicating whether the
+ * token was valid and has been revoked.
+ */
+extern int SignedTokenRevoke(char *);
+
+#endif                             /* TELODENDRIA_SIGNEDTOKEN_H */
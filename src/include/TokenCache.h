@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TELODENDRIA_TOKENCACHE_H
+#define TELODENDRIA_TOKENCACHE_H
+
+/***
+ * @Nm TokenCache
+ * @Nd In-memory cache of resolved access tokens.
+ * @Dd October 15 2026
+ * @Xr User
+ *
+ * .Nm
+ * keeps recently used access tokens resolved in memory so that
+ * .Fn UserAuthenticate
+ * does not have to go to the database for the token object on every
+ * authenticated request. The cache is split into a number of shards,
+ * each with its own lock, and each shard is bounded and evicts its
+ * least recently used entries. Tokens that were looked up but do not
+ * exist are also remembered for a short while, so that clients
+ * hammering the server with a stale token don't cause a database
+ * lookup each time.
+ * .Pp
+ * The cache is process-global. Until
+ * .Fn TokenCacheInit
+ * is called, every lookup is a miss and all other functions do
+ * nothing, so code that never initializes the cache keeps working.
+ */
+
+#include <Cytoplasm/HashMap.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * The number of entries the cache holds if 0 is passed to
+ * .Fn TokenCacheInit .
+ */
+#define TOKEN_CACHE_DEFAULT_SIZE 4096
+
+/**
+ * A resolved access token, as stored in the cache.
+ */
+typedef struct TokenCacheInfo
+{
+    char *user;
+    char *deviceId;
+    uint64_t expires;
+    int privileges;
+} TokenCacheInfo;
+
+/**
+ * The possible outcomes of a cache lookup.
+ */
+typedef enum TokenCacheResult
+{
+    TOKEN_CACHE_MISS,
+    TOKEN_CACHE_HIT,
+    TOKEN_CACHE_UNKNOWN
+} TokenCacheResult;
+
+/**
+ * Set up the global token cache, bounding it to the given number of
+ * entries in total.
+ */
+extern void TokenCacheInit(size_t);
+
+/**
+ * Tear down the global token cache, freeing all of its entries.
+ */
+extern void TokenCacheFree(void);
+
+/**
+ * Look up an access token. If the token is cached, this function
+ * returns
+ * .Dv TOKEN_CACHE_HIT
+ * and fills in the passed structure with copies of the cached values,
+ * which must be released with
+ * .Fn TokenCacheInfoFree .
+ * If the token is known not to exist,
+ * .Dv TOKEN_CACHE_UNKNOWN
+ * is returned, and if the cache knows nothing about the token,
+ * .Dv TOKEN_CACHE_MISS
+ * is returned and the database should be consulted.
+ */
+extern TokenCacheResult TokenCacheGet(char *, TokenCacheInfo *);
+
+/**
+ * Store a resolved access token in the cache. The values in the
+ * passed structure are copied.
+ */
+extern void TokenCachePut(char *, TokenCacheInfo *);
+
+/**
+ * Remember that the given access token does not exist.
+ */
+extern void TokenCachePutUnknown(char *);
+
+/**
+ * Drop the given access token from the cache. This must be called
+ * whenever an access token is created or deleted.
+ */
+extern void TokenCacheInvalidate(char *);
+
+/**
+ * Drop all of the cached access tokens that belong to the user with
+ * the given localpart. This is used when something about the user
+ * changes that is reflected in the cached entries, such as its
+ * privileges, or when the user is deactivated.
+ */
+extern void TokenCacheInvalidateUser(char *);
+
+/**
+ * Free the values copied into a structure by
+ * .Fn TokenCacheGet .
+ * The structure itself is not freed.
+ */
+extern void TokenCacheInfoFree(TokenCacheInfo *);
+
+/**
+ * Get the cache counters, which include hits, misses, negative hits,
+ * evictions, and the current number of entries, as a JSON object
+ * suitable for the administrator API.
+ */
+extern HashMap * TokenCacheStats(void);
+
+#endif                             /* TELODENDRIA_TOKENCACHE_H */
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TELODENDRIA_TOKENEXPIRY_H
+#define TELODENDRIA_TOKENEXPIRY_H
+
+/***
+ * @Nm TokenExpiry
+ * @Nd Index access tokens by expiry time and sweep out expired ones.
+ * @Dd October 15 2026
+ * @Xr User Cron
+ *
+ * Access tokens that are issued with a refresh token expire, but
+ * nothing else ever removes them, so
+ * .Nm
+ * keeps an index of them grouped into fixed-width time buckets. Each
+ * bucket is its own database object, so a sweep only has to look at
+ * the buckets that have come due, rather than at every token.
+ * .Pp
+ * A token is not swept the moment it expires, because the client is
+ * expected to refresh it after that. Only once a grace period has
+ * also passed is the session considered abandoned, and its access
+ * token, refresh token, and device are deleted.
+ */
+
+#include <Cytoplasm/Db.h>
+
+#include <stdint.h>
+
+/**
+ * Add an access token to the expiry index. This takes the token, the
+ * localpart of the user it belongs to, and the timestamp in
+ * milliseconds at which it expires. It returns a boolean value
+ * indicating success.
+ */
+extern int TokenExpiryAdd(Db *, char *, char *, uint64_t);
+
+/**
+ * Delete the sessions of all indexed tokens whose grace period has
+ * passed, in bounded batches. This is intended to be run
+ * periodically as a
+ * .Xr Cron 3
+ * job. The first time it runs on a database that has no index yet,
+ * it indexes all existing tokens.
+ */
+extern void TokenExpirySweep(Db *);
+
+#endif                             /* TELODENDRIA_TOKENEXPIRY_H */
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TELODENDRIA_TRACE_H
+#define TELODENDRIA_TRACE_H
+
+/***
+ * @Nm Trace
+ * @Nd Capture where the time went in slow requests.
+ * @Dd October 15 2026
+ * @Xr Matrix Metrics Db
+ *
+ * .Nm
+ * records a timeline for every request as it is handled: how long
+ * each phase took, which user made it, and which database objects
+ * were locked and how long each lock took to get. Requests that take
+ * longer than a configured threshold are copied into a bounded ring,
+ * from which they can be retrieved through the administrator API;
+ * all other timelines are simply thrown away.
+ * .Pp
+ * Each thread keeps the timeline for the request it is handling, so
+ * recording a phase or a lock never waits on another thread. Only a
+ * slow request takes the lock on the ring, to copy itself in. Outside
+ * of a request, such as in background jobs, all recording functions
+ * do nothing.
+ */
+
+#include <Cytoplasm/Db.h>
+#include <Cytoplasm/Array.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The number of slow requests that are kept. Once the ring is full,
+ * the oldest request is replaced by the next slow one.
+ */
+#define TRACE_RING_SIZE 64
+
+/**
+ * Lock a database object exactly like
+ * .Fn DbLock ,
+ * additionally recording the lock in the current request's trace.
+ * The arguments naming the object are evaluated twice, so they must
+ * not have side effects.
+ */
+#define TraceDbLock(db, ...) \
+    (TraceLockBegin(), TraceLockEnd(DbLock(db, __VA_ARGS__), __VA_ARGS__))
+
+/**
+ * Set up the ring of slow requests, keeping requests that took at
+ * least the given number of milliseconds. If the threshold is
+ * negative, tracing is disabled.
+ */
+extern void TraceInit(long);
+
+/**
+ * Free the ring of slow requests.
+ */
+extern void TraceFree(void);
+
+/**
+ * Start tracing a request on the calling thread, given its method and
+ * path.
+ */
+extern void TraceBegin(const char *, char *);
+
+/**
+ * Add the given number of microseconds to the named phase of the
+ * current request. The name must be a string constant.
+ */
+extern void TracePhase(char *, uint64_t);
+
+/**
+ * Note the user that the current request is authenticated as.
+ */
+extern void TraceUser(char *);
+
+/**
+ * Note that the calling thread is about to wait on a database lock.
+ * This is used by
+ * .Fn TraceDbLock ,
+ * and should not have to be called directly.
+ */
+extern void TraceLockBegin(void);
+
+/**
+ * Record that the calling thread has finished waiting on the database
+ * lock for the object named by the given path, returning the given
+ * reference. This is used by
+ * .Fn TraceDbLock ,
+ * and should not have to be called directly.
+ */
+extern DbRef * TraceLockEnd(DbRef *, size_t,...);
+
+/**
+ * Finish tracing the current request, given the name of the route
+ * that handled it and its response status. If it was slow, it is
+ * copied into the ring.
+ */
+extern void TraceEnd(char *, int);
+
+/**
+ * Get the slow requests in the ring, newest first, as an array of
+ * JSON values. The caller is responsible for freeing the array and
+ * its values.
+ */
+extern Array * TraceList(void);
+
+#endif                             /* TELODENDRIA_TRACE_H */
@@ -40,6 +40,12 @@
  * .Fn UiaComplete .
  * The goal is to make it easy for the numerous API endpoints that
  * utilize this authentication mechanism to implement it.
+ * .Pp
+ * Sessions only last a few minutes, so they are kept in memory rather
+ * than in the database. The number of sessions is bounded; when the
+ * limit is reached, the least recently used session is dropped. The
+ * sessions can optionally be saved to the database when the server
+ * shuts down, to be picked up again when it starts.
  */
 
 #include <Cytoplasm/Array.h>
@@ -47,6 +53,13 @@
 #include <Cytoplasm/HttpServer.h>
 #include <Matrix.h>
 
+/**
+ * The number of sessions kept in memory if no other limit is given
+ * to
+ * .Fn UiaInit .
+ */
+#define UIA_DEFAULT_MAX_SESSIONS 8192
+
 /**
  * An opaque structure that represents a single stage, which consists
  * of the type and a JSON object that contains implementation-specific
@@ -72,15 +85,45 @@ extern UiaStage * UiaStageBuild(char *, HashMap *);
  */
 extern Array * UiaDummyFlow(void);
 
+/**
+ * Set up the session store, keeping at most the given number of
+ * sessions, or
+ * .Dv UIA_DEFAULT_MAX_SESSIONS
+ * if it is 0. Sessions saved in the given database at the last
+ * shutdown are restored and removed from the database. The boolean
+ * argument sets whether
+ * .Fn UiaFree
+ * should save the sessions again.
+ */
+extern void UiaInit(Db *, size_t, int);
+
+/**
+ * Free the session store, first saving the sessions to the given
+ * database if
+ * .Fn UiaInit
+ * was asked to. This should be called when the server shuts down.
+ */
+extern void UiaFree(Db *);
+
 /**
  * This function should be called periodically to purge old sessions.
  * Sessions are only valid for a few minutes after their last access.
- * After that, they should be purged so that the database doesn't fill
- * up with old session files. This function is specifically designed
- * to be called via the Cron API.
+ * After that, they should be purged so that they don't take up space
+ * in the store. Sessions are kept in the order they were last
+ * accessed, so each call only looks at the sessions that have
+ * actually expired. This function is specifically designed to be
+ * called via the Cron API.
  */
 extern void UiaCleanup(MatrixHttpHandlerArgs *);
 
+/**
+ * Get a copy of a string value stored in the given session, such as
+ * the registration token that was used to complete it. This function
+ * returns NULL if the session or the value does not exist. The caller
+ * must free the returned string.
+ */
+extern char * UiaSessionGet(char *, char *);
+
 /**
  * Validate an auth object and maintain session state to track the
  * progress of a client through user interactive authentication flows.
@@ -104,8 +147,8 @@ extern void UiaCleanup(MatrixHttpHandlerArgs *);
  * An HTTP server context. This is required to set the response headers
  * in the even of an error.
  * .It
- * The database where user interactive authentication sessions are
- * persisted.
+ * The database, which some stages need to verify the client's
+ * credentials.
  * .It
  * The JSON request body that contains the client's auth object, which
  * will be read, parsed, and handled as appropriate.
@@ -133,7 +176,7 @@ extern void UiaCleanup(MatrixHttpHandlerArgs *);
  * the caller proceed with its logic.
  */
 extern int
- UiaComplete(Array *, HttpServerContext *, Db *, HashMap *, HashMap **, Config);
+ UiaComplete(Array *, HttpServerContext *, Db *, HashMap *, HashMap **, Config *);
 
 /**
  * Free an array of flows, as described above. Even though the caller
@@ -134,6 +134,22 @@ extern User * UserCreate(Db *, char *, char *);
  */
 extern User * UserLock(Db *, char *);
 
+/**
+ * Like
+ * .Fn UserLock ,
+ * but obtain a read-only reference to the user. Any number of threads
+ * may hold a read-only reference to the same user at once; only
+ * .Fn UserLock
+ * waits for them to finish. A read-only reference is backed by an
+ * in-memory copy of the user, so it usually doesn't touch the
+ * database at all, and unlocking it writes nothing back. Functions
+ * that modify the user fail on a read-only reference, and any JSON
+ * obtained from it must not be modified. Because other threads may be
+ * reading the same copy, objects in it may only be iterated with
+ * .Fn HashMapIterateReentrant .
+ */
+extern User * UserLockShared(Db *, char *);
+
 /**
  * Take an access token, figure out what user it belongs to, and then
  * returns a reference to that user. This function should be used by
@@ -142,6 +158,16 @@ extern User * UserLock(Db *, char *);
  */
 extern User * UserAuthenticate(Db *, char *);
 
+/**
+ * Like
+ * .Fn UserAuthenticate ,
+ * but obtain a read-only reference to the user as described in
+ * .Fn UserLockShared .
+ * Endpoints that only need to know who the user is should prefer
+ * this function.
+ */
+extern User * UserAuthenticateShared(Db *, char *);
+
 /**
  * Return a user reference back to the database. This function uses
  * .Fn DbUnlock
@@ -149,6 +175,13 @@ extern User * UserAuthenticate(Db *, char *);
  */
 extern bool UserUnlock(User *);
 
+/**
+ * Free the per-user locks and the cached read-only copies of users.
+ * This should only be called when no user references are held
+ * anymore, such as at shutdown.
+ */
+extern void UserLockTableFree(void);
+
 /**
  * Log in a user. This function takes the user's password, desired
  * device ID and display name, and a boolean value indicating whether 
@@ -220,6 +253,7 @@ extern bool UserDeactivated(User *);
  * identical to what's stored in the database. In fact, this JSON is
  * still linked to the database, so it should not be freed with
  * .Fn JsonFree .
+ * If the user was locked read-only, it must not be modified either.
  */
 extern HashMap * UserGetDevices(User *);
 
@@ -236,6 +270,24 @@ extern UserAccessToken * UserAccessTokenGenerate(User *, char *, int);
  */
 extern bool UserAccessTokenSave(Db *, UserAccessToken *);
 
+/**
+ * Delete the specified access token from the database, making sure
+ * that it is also dropped from the token cache so it can no longer
+ * be used to authenticate. Signed tokens are revoked instead. This
+ * function returns a boolean value indicating whether or not the
+ * token was deleted.
+ */
+extern bool UserAccessTokenDelete(Db *, char *);
+
+/**
+ * Look up the user and device that the specified access token was
+ * issued to, duplicating them into the given pointers. The caller is
+ * responsible for freeing them. The expiry of the token is not
+ * checked. This function returns a boolean value indicating whether
+ * or not the token exists.
+ */
+extern bool UserAccessTokenInfo(Db *, char *, char **, char **);
+
 /**
  * Free the memory associated with the given access token.
  */
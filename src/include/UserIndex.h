@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ * with other valuable contributors. See CONTRIBUTORS.txt for the full list.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef TELODENDRIA_USERINDEX_H
+#define TELODENDRIA_USERINDEX_H
+
+/***
+ * @Nm UserIndex
+ * @Nd In-memory search index for the user directory.
+ * @Dd October 15 2026
+ * @Xr User
+ *
+ * .Nm
+ * keeps the localparts, display names, and avatars of all active
+ * local users in memory, along with trigram postings over the
+ * lowercased localparts and display names. This allows the user
+ * directory to be searched without loading every user from the
+ * database.
+ * .Pp
+ * The index is process-global. It is built from the database on a
+ * background thread when the server starts, and kept up to date by
+ * the
+ * .Xr User 3
+ * API as users are created, change their profile, or are deactivated.
+ * Until the initial build completes, searches report that the index
+ * is not ready, and the caller should fall back to scanning the
+ * database.
+ */
+
+#include <Cytoplasm/Array.h>
+#include <Cytoplasm/Db.h>
+
+#include <stddef.h>
+
+/**
+ * The most results that
+ * .Fn UserIndexSearch
+ * will return, whatever limit it is given.
+ */
+#define USER_INDEX_MAX_LIMIT 100
+
+/**
+ * A single search result. All of the fields are copies owned by the
+ * result array.
+ */
+typedef struct UserIndexResult
+{
+    char *name;
+    char *displayName;
+    char *avatarUrl;
+} UserIndexResult;
+
+/**
+ * Set up the index and start building it from the users in the given
+ * database on a background thread.
+ */
+extern void UserIndexInit(Db *);
+
+/**
+ * Stop the background build if it is still running, and free the
+ * index.
+ */
+extern void UserIndexFree(void);
+
+/**
+ * Add a user to the index or update its entry, given its localpart,
+ * display name, and avatar URL. The latter two may be NULL.
+ */
+extern void UserIndexPut(char *, char *, char *);
+
+/**
+ * Remove the user with the given localpart from the index.
+ */
+extern void UserIndexRemove(char *);
+
+/**
+ * Search the index for users whose localpart or display name contains
+ * the given search term, ignoring case. At most the given number of
+ * results, and never more than
+ * .Dv USER_INDEX_MAX_LIMIT ,
+ * are returned, best matches first: exact matches, then
+ * prefix matches, then any other matches. If there were more matches
+ * than that, the integer pointed to is set to a non-zero value.
+ * .Pp
+ * This function returns NULL if the index is not ready yet, or if
+ * memory could not be allocated. Otherwise,
+ * it returns an array of results that must be freed with
+ * .Fn UserIndexResultsFree .
+ */
+extern Array * UserIndexSearch(char *, size_t, int *);
+
+/**
+ * Free an array of results returned by
+ * .Fn UserIndexSearch .
+ */
+extern void UserIndexResultsFree(Array *);
+
+#endif                             /* TELODENDRIA_USERINDEX_H */